@@ -17,40 +17,228 @@
 #include <linux/sched.h>
 #include <linux/usb.h>
 #include <linux/wait.h>
-#include <linux/timer.h>
 #include <linux/workqueue.h>
+#include <linux/moduleparam.h>
 #include <linux/power_supply.h>
 #include <linux/device.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/average.h>
+#include <kunit/visibility.h>
+
+#include "vxe-protocol.h"
+#include "vxe-history.h"
+#include "hid-vxe-r1.h"
+
+#define CREATE_TRACE_POINTS
+#include "vxe-trace.h"
 
 
 // Define the interface number we want to poll for battery status
 #define TARGET_INTERFACE 1
-// Define polling interval for battery status in milliseconds
-#define BATTERY_POLL_INTERVAL_MS 30000
 // Define the request packet for battery status
-#define REPORT_ID 0x08
+#define REPORT_ID VXE_REPORT_ID
+// Polling never goes faster than this, regardless of the module parameters
+#define BATTERY_POLL_FLOOR_MS 1000
+// Until the first reading arrives, lost requests are retried after this
+// delay, doubling up to poll_min_ms
+#define FIRST_RETRY_MS 250
+// Regular polls due within this long of each other are sent in the same tick
+#define POLL_BATCH_MS 200
+// A regular poll counts as lost if it isn't answered within this long, the
+// wait doubles with every retry
+#define REQUEST_TIMEOUT_MS 1000
+// Lost polls are retried this many times, then the next regular poll is waited for
+#define REQUEST_RETRIES 2
+// The power supply is registered once the first reading is in, or after this
+// long without one, so userspace never sees a battery at -1% that is about to update
+#define FIRST_SAMPLE_DEADLINE_MS 2000
+
+// Polling interval bounds in milliseconds. The driver polls at the minimum
+// while the battery is charging or its level is moving and doubles the
+// interval up to the maximum for as long as readings stay the same.
+static unsigned int poll_min_ms = 10000;
+module_param(poll_min_ms, uint, 0644);
+MODULE_PARM_DESC(poll_min_ms, "Shortest battery polling interval in milliseconds (default 10000)");
+
+static unsigned int poll_max_ms = 300000;
+module_param(poll_max_ms, uint, 0644);
+MODULE_PARM_DESC(poll_max_ms, "Longest battery polling interval in milliseconds (default 300000)");
+
+// Voltage readings jitter by a few millivolts between polls, only a drift
+// of at least this much since the last notification is reported to userspace
+static unsigned int voltage_hysteresis_mv = 20;
+module_param(voltage_hysteresis_mv, uint, 0644);
+MODULE_PARM_DESC(voltage_hysteresis_mv, "Voltage change in mV that triggers a power supply change notification (default 20)");
+
+static unsigned int stale_ms = 900000;
+module_param(stale_ms, uint, 0644);
+MODULE_PARM_DESC(stale_ms, "Age in milliseconds after which the last reading is reported as offline with an unknown status, 0 to never (default 900000)");
+
+// Lazy mode: instead of polling on a schedule, the battery is only queried
+// when someone reads the power supply and the last reading is older than
+// lazy_ttl_ms. The reader waits up to lazy_wait_ms for the fresh reading.
+// Set through vxe_set_lazy_ttl_ms, which restarts polling when it is turned off.
+static unsigned int lazy_ttl_ms;
+
+static unsigned int lazy_wait_ms = 200;
+module_param(lazy_wait_ms, uint, 0644);
+MODULE_PARM_DESC(lazy_wait_ms, "How long a reader waits for a refresh in lazy mode, in milliseconds (default 200)");
+
+// All batteries known to the driver, one per physical mouse
+static LIST_HEAD(vxe_batteries);
+// Protects vxe_batteries and the transport bookkeeping of every battery
+static DEFINE_MUTEX(vxe_batteries_lock);
+// Transports the tick sends a poll to once it has dropped vxe_batteries_lock.
+// Only used by the tick: filled under vxe_batteries_lock and emptied under
+// vxe_send_lock, which the tick takes before it releases vxe_batteries_lock.
+static LIST_HEAD(vxe_send_queue);
+// Held by the tick while it sends, a control transfer can block for seconds.
+// Taken after vxe_batteries_lock, see vxe_wait_for_sends.
+static DEFINE_MUTEX(vxe_send_lock);
+
+// Driver-private workqueue, every battery is polled from the shared tick on it
+static struct workqueue_struct *vxe_wq;
+static void vxe_poll_tick(struct work_struct *work);
+static DECLARE_DEFERRABLE_WORK(vxe_tick_work, vxe_poll_tick);
+
+// Has the scheduler poll a battery right away, from any context
+static void vxe_battery_poll_soon(struct vxe_battery *battery) {
+    WRITE_ONCE(battery->poll_now, true);
+    mod_delayed_work(vxe_wq, &vxe_tick_work, 0);
+}
 
-// Structure to hold device-specific data
-struct vxe_mouse {
-    struct hid_device *hdev;
-    struct timer_list battery_poll_timer;
-    struct work_struct battery_request_work;
+/*
+ * Updates lazy_ttl_ms. Turning lazy mode off restarts polling of every
+ * battery, while it is on the scheduler stops once a battery has a reading.
+ */
+static int vxe_set_lazy_ttl_ms(const char *val, const struct kernel_param *kp) {
+    struct vxe_battery *battery;
+    int ret = param_set_uint(val, kp);
+
+    if (ret || READ_ONCE(lazy_ttl_ms))
+        return ret;
 
-    char psy_name[32];
+    mutex_lock(&vxe_batteries_lock);
+    list_for_each_entry(battery, &vxe_batteries, list) {
+        if (battery->active)
+            vxe_battery_poll_soon(battery);
+    }
+    mutex_unlock(&vxe_batteries_lock);
+    return 0;
+}
 
-    // Fields for power supply management
-    struct power_supply *power_supply;
-    int battery_capacity; // To store the last known capacity
-    int battery_status;   // To store the last known status (e.g., charging/discharging)
-    int battery_voltage;  // To store the last known voltage
+static const struct kernel_param_ops vxe_lazy_ttl_ms_ops = {
+    .set = vxe_set_lazy_ttl_ms,
+    .get = param_get_uint,
 };
+module_param_cb(lazy_ttl_ms, &vxe_lazy_ttl_ms_ops, &lazy_ttl_ms, 0644);
+MODULE_PARM_DESC(lazy_ttl_ms, "Query the battery only when it is read and the last reading is older than this, in milliseconds (default 0, poll on a schedule)");
+
+// Handler for a report received on the battery interface
+typedef void (*vxe_report_handler)(struct vxe_mouse *vxe_dev, u8 *data, int size);
+
+static void vxe_battery_response(struct vxe_mouse *vxe_dev, u8 *data, int size);
+
+/*
+ * Commands sent over the active transport every poll cycle. They are queued
+ * back to back from a single wakeup and their responses are matched back to
+ * them by command ID.
+ */
+static const struct vxe_command {
+    u8 id;
+    vxe_report_handler handle_response;
+} vxe_commands[VXE_COMMAND_COUNT] = {
+    [VXE_COMMAND_BATTERY] = { VXE_CMD_BATTERY, vxe_battery_response },
+};
+
+// Stores a new battery sample and its history record, called with battery_lock held for writing
+static void vxe_battery_store(struct vxe_battery *battery, const struct vxe_battery_sample *sample) {
+    struct vxe_history_record *record = &battery->history[battery->history_seq % VXE_HISTORY_SIZE];
+
+    battery->battery = *sample;
+    record->timestamp_ns = ktime_to_ns(sample->timestamp);
+    record->sequence = battery->history_seq;
+    record->voltage_mv = sample->voltage;
+    record->capacity = sample->capacity;
+    record->status = sample->status;
+    battery->history_seq++;
+}
+
+// Wakes up the readers waiting for a sample, called after it has been stored
+static void vxe_battery_stored(struct vxe_battery *battery) {
+    // Any outstanding refresh has been answered
+    WRITE_ONCE(battery->refresh_jiffies, 0);
+    if (wq_has_sleeper(&battery->sample_wait))
+        wake_up_all(&battery->sample_wait);
+}
+
+/*
+ * Publishes a new battery sample. Writes happen once per poll, so taking the
+ * lock costs nothing, and reports may arrive in interrupt context.
+ */
+VISIBLE_IF_KUNIT void vxe_battery_publish(struct vxe_battery *battery, const struct vxe_battery_sample *sample) {
+    unsigned long flags;
+
+    write_seqlock_irqsave(&battery->battery_lock, flags);
+    vxe_battery_store(battery, sample);
+    write_sequnlock_irqrestore(&battery->battery_lock, flags);
+
+    vxe_battery_stored(battery);
+}
+EXPORT_SYMBOL_IF_KUNIT(vxe_battery_publish);
+
+// Takes a consistent copy of the last published battery sample
+VISIBLE_IF_KUNIT void vxe_battery_read(struct vxe_battery *battery, struct vxe_battery_sample *sample) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&battery->battery_lock);
+        *sample = battery->battery;
+    } while (read_seqretry(&battery->battery_lock, seq));
+}
+EXPORT_SYMBOL_IF_KUNIT(vxe_battery_read);
+
+/*
+ * Requests a refresh of the battery in lazy mode and waits for it until
+ * lazy_wait_ms after the request. Concurrent readers share one request,
+ * a request that is never answered is retried after a second.
+ * Returns true if a new sample has been published meanwhile.
+ */
+static bool vxe_battery_refresh(struct vxe_battery *battery) {
+    u32 seq = READ_ONCE(battery->history_seq);
+    unsigned long requested = READ_ONCE(battery->refresh_jiffies);
+    unsigned long now = jiffies | 1; // 0 means no outstanding refresh
+
+    if (!requested || time_after(now, requested + HZ)) {
+        if (cmpxchg(&battery->refresh_jiffies, requested, now) == requested)
+            vxe_battery_poll_soon(battery);
+        requested = READ_ONCE(battery->refresh_jiffies);
+    }
+
+    // jiffies is sampled once, so the timeout can't wrap if the deadline passes in between
+    long remaining = (long)(requested + msecs_to_jiffies(READ_ONCE(lazy_wait_ms)) - jiffies);
+    if (!requested || remaining <= 0)
+        return READ_ONCE(battery->history_seq) != seq;
+
+    return wait_event_interruptible_timeout(battery->sample_wait, READ_ONCE(battery->history_seq) != seq,
+                                            remaining) > 0;
+}
 
 // Declare supported power supply properties
 static enum power_supply_property vxe_power_supply_props[] = {
     POWER_SUPPLY_PROP_STATUS,
+    POWER_SUPPLY_PROP_ONLINE,
     POWER_SUPPLY_PROP_CAPACITY,
     POWER_SUPPLY_PROP_CAPACITY_LEVEL,
     POWER_SUPPLY_PROP_VOLTAGE_NOW,
+    POWER_SUPPLY_PROP_TIME_TO_EMPTY_NOW,
+    POWER_SUPPLY_PROP_TIME_TO_FULL_NOW,
 
     POWER_SUPPLY_PROP_SCOPE,
     POWER_SUPPLY_PROP_MODEL_NAME,
@@ -58,30 +246,65 @@ static enum power_supply_property vxe_power_supply_props[] = {
     POWER_SUPPLY_PROP_SERIAL_NUMBER,
 };
 
+// Whether a reading is too old to be reported as the current state
+static bool vxe_battery_sample_stale(const struct vxe_battery_sample *sample) {
+    unsigned int max_age_ms = READ_ONCE(stale_ms);
+
+    return max_age_ms && sample->capacity >= 0 &&
+           ktime_ms_delta(ktime_get_boottime(), sample->timestamp) > max_age_ms;
+}
+
 // Callback function to get properties
 static int vxe_power_supply_get_property(
     struct power_supply *psy,
     enum power_supply_property psp,
     union power_supply_propval *val
 ) {
-    struct vxe_mouse *vxe_dev = power_supply_get_drvdata(psy);
+    struct vxe_battery *vxe_bat = power_supply_get_drvdata(psy);
+    struct vxe_battery_sample battery;
     int ret = 0;
 
-    if (!vxe_dev)
+    if (!vxe_bat)
         return -EINVAL;
 
+    vxe_battery_read(vxe_bat, &battery);
+
+    // Like the synchronous HID battery reads in hid-input, this may sleep
+    unsigned int ttl_ms = READ_ONCE(lazy_ttl_ms);
+    if (ttl_ms && battery.capacity >= 0 && !READ_ONCE(vxe_bat->registering) &&
+        ktime_ms_delta(ktime_get_boottime(), battery.timestamp) > ttl_ms &&
+        vxe_battery_refresh(vxe_bat))
+        vxe_battery_read(vxe_bat, &battery);
+
+    // The mouse is asleep or out of range, the last level is kept but nothing derived from it
+    bool stale = vxe_battery_sample_stale(&battery);
+
     switch (psp) {
     case POWER_SUPPLY_PROP_STATUS:
-        val->intval = vxe_dev->battery_status;
+        val->intval = stale ? POWER_SUPPLY_STATUS_UNKNOWN : battery.status;
+        break;
+    case POWER_SUPPLY_PROP_ONLINE:
+        val->intval = battery.capacity >= 0 && !stale;
         break;
     case POWER_SUPPLY_PROP_CAPACITY:
-        val->intval = vxe_dev->battery_capacity;
+        val->intval = battery.capacity;
         break;
     case POWER_SUPPLY_PROP_CAPACITY_LEVEL:
-        val->intval = vxe_dev->battery_capacity;
+        val->intval = battery.capacity;
         break;
     case POWER_SUPPLY_PROP_VOLTAGE_NOW:
-        val->intval = vxe_dev->battery_voltage * 1000; // Convert mV to uV
+        val->intval = battery.voltage * 1000; // Convert mV to uV
+        break;
+    // Both estimates are computed when the sample arrives, see vxe_battery_estimate
+    case POWER_SUPPLY_PROP_TIME_TO_EMPTY_NOW:
+        if (battery.time_to_empty < 0 || stale)
+            return -ENODATA;
+        val->intval = battery.time_to_empty;
+        break;
+    case POWER_SUPPLY_PROP_TIME_TO_FULL_NOW:
+        if (battery.time_to_full < 0 || stale)
+            return -ENODATA;
+        val->intval = battery.time_to_full;
         break;
     case POWER_SUPPLY_PROP_SCOPE:
         val->intval = POWER_SUPPLY_SCOPE_DEVICE;
@@ -93,7 +316,7 @@ static int vxe_power_supply_get_property(
         val->strval = "VXE";
         break;
     case POWER_SUPPLY_PROP_SERIAL_NUMBER:
-        val->strval = vxe_dev->hdev->uniq;
+        val->strval = vxe_bat->uniq;
         break;
     default:
         ret = -EINVAL;
@@ -102,83 +325,742 @@ static int vxe_power_supply_get_property(
     return ret;
 }
 
+static ssize_t poll_interval_ms_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct vxe_battery *battery = power_supply_get_drvdata(dev_get_drvdata(dev));
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(battery->poll_interval_ms));
+}
+static DEVICE_ATTR_RO(poll_interval_ms);
+
+static ssize_t poll_wakeups_saved_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct vxe_battery *battery = power_supply_get_drvdata(dev_get_drvdata(dev));
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(battery->wakeups_saved));
+}
+static DEVICE_ATTR_RO(poll_wakeups_saved);
+
 /*
- * Retrieves the output reports from the HID device and sends a request
- * to the mouse to get the battery status.
- * This function is scheduled to run in a process context via a workqueue.
+ * Reads the battery history, a struct vxe_history_header followed by the
+ * sample ring. The file fits in one page, so a read of the whole file gets
+ * a consistent snapshot without ever blocking the report handler.
  */
-static void vxe_battery_work_handler(struct work_struct *work) {
-    // Get the containing vxe_mouse structure from the work_struct and access the hid_device
-    struct vxe_mouse *vxe_dev = container_of(work, struct vxe_mouse, battery_request_work);
+static ssize_t history_read(struct file *file, struct kobject *kobj, const struct bin_attribute *attr,
+                            char *buf, loff_t off, size_t count) {
+    struct vxe_battery *battery = power_supply_get_drvdata(dev_get_drvdata(kobj_to_dev(kobj)));
+    struct vxe_history_header header = {
+        .magic = VXE_HISTORY_MAGIC,
+        .version = VXE_HISTORY_VERSION,
+        .record_size = sizeof(struct vxe_history_record),
+        .capacity = VXE_HISTORY_SIZE,
+    };
+    size_t size = sizeof(header) + sizeof(battery->history);
+    unsigned int seq;
+
+    // A read split over several pages could mix two snapshots
+    BUILD_BUG_ON(sizeof(header) + sizeof(battery->history) > PAGE_SIZE);
+
+    if (off >= size)
+        return 0;
+    count = min_t(size_t, count, size - off);
+
+    do {
+        seq = read_seqbegin(&battery->battery_lock);
+        header.sequence = battery->history_seq;
+        for (size_t pos = off; pos < off + count;) {
+            size_t len;
+
+            if (pos < sizeof(header)) {
+                len = min_t(size_t, sizeof(header) - pos, off + count - pos);
+                memcpy(buf + pos - off, (u8 *)&header + pos, len);
+            } else {
+                len = off + count - pos;
+                memcpy(buf + pos - off, (u8 *)battery->history + pos - sizeof(header), len);
+            }
+            pos += len;
+        }
+    } while (read_seqretry(&battery->battery_lock, seq));
+
+    return count;
+}
+static BIN_ATTR_RO(history, sizeof(struct vxe_history_header) +
+                            VXE_HISTORY_SIZE * sizeof(struct vxe_history_record));
+
+// Extra attributes exposed next to the standard power supply properties
+static struct attribute *vxe_battery_attrs[] = {
+    &dev_attr_poll_interval_ms.attr,
+    &dev_attr_poll_wakeups_saved.attr,
+    NULL,
+};
+
+static const struct bin_attribute *const vxe_battery_bin_attrs[] = {
+    &bin_attr_history,
+    NULL,
+};
+
+static const struct attribute_group vxe_battery_group = {
+    .attrs = vxe_battery_attrs,
+    .bin_attrs = vxe_battery_bin_attrs,
+};
+__ATTRIBUTE_GROUPS(vxe_battery);
+
+/*
+ * Checks the layout of the vendor output report once and builds the report
+ * of every command into a buffer usable for DMA, so sending a command
+ * doesn't touch the report objects HID core shares with hidraw.
+ */
+static int vxe_prepare_requests(struct vxe_mouse *vxe_dev) {
     struct hid_device *hdev = vxe_dev->hdev;
+    struct hid_report *report;
+
+    report = hid_validate_values(hdev, HID_OUTPUT_REPORT, REPORT_ID, 0, VXE_REPORT_VALUES);
+    if (!report || hid_report_len(report) != VXE_REPORT_SIZE) {
+        hid_err(hdev, "unexpected output report layout\n");
+        return -EINVAL;
+    }
+
+    vxe_dev->requests = kmalloc_array(VXE_COMMAND_COUNT, VXE_REPORT_SIZE, GFP_KERNEL);
+    if (!vxe_dev->requests)
+        return -ENOMEM;
+
+    for (int i = 0; i < VXE_COMMAND_COUNT; i++)
+        vxe_build_command(&vxe_dev->requests[i * VXE_REPORT_SIZE], vxe_commands[i].id);
+    return 0;
+}
+
+/*
+ * Sends a prebuilt command as a SET_REPORT control transfer, the vendor
+ * interface has no interrupt OUT endpoint. The buffers are never written
+ * after probe, so no locking is needed, but the transfer is synchronous and
+ * sleeps until the mouse acknowledges it or it times out. Only called from
+ * the tick, without vxe_batteries_lock held.
+ */
+static int vxe_send_command(struct vxe_mouse *vxe_dev, enum vxe_command_index index) {
+    struct hid_device *hdev = vxe_dev->hdev;
+    int ret;
+
+    ret = hid_hw_raw_request(hdev, REPORT_ID, &vxe_dev->requests[index * VXE_REPORT_SIZE], VXE_REPORT_SIZE,
+                             HID_OUTPUT_REPORT, HID_REQ_SET_REPORT);
+    if (ret < 0)
+        return ret;
+
+    hid_dbg(hdev, "raw request sent for command 0x%02x\n", vxe_commands[index].id);
+    return 0;
+}
+
+/*
+ * Sends a command over the transport and starts timing it.
+ * A request that is still outstanding at this point never got a response.
+ */
+static void vxe_request(struct vxe_mouse *vxe_dev, enum vxe_command_index index) {
+    struct vxe_stats *stats = &vxe_dev->stats;
+    u8 command = vxe_commands[index].id;
+    int ret;
+
+    // The tick never gets here for a suspended transport, see vxe_suspend
+    if (READ_ONCE(vxe_dev->suspended))
+        WRITE_ONCE(stats->suspended_requests, stats->suspended_requests + 1);
 
-    struct list_head *report_list = &hdev->report_enum[HID_OUTPUT_REPORT].report_list;
-    if (list_empty(report_list)) {
-        hid_err(hdev, "no output reports found\n");
+    if (atomic64_xchg(&stats->request_sent_ns[index], ktime_get_ns())) {
+        WRITE_ONCE(stats->lost, stats->lost + 1);
+        WRITE_ONCE(stats->last_error, -ETIMEDOUT);
+    }
+
+    ret = vxe_send_command(vxe_dev, index);
+    trace_vxe_request(vxe_dev->hdev, command, ret);
+    if (ret) {
+        atomic64_set(&stats->request_sent_ns[index], 0);
+        WRITE_ONCE(stats->last_error, ret);
         return;
     }
-    
-    struct hid_report *report;
-    /*hid_info(hdev, "Output reports:\n");
-    list_for_each_entry(report, report_list, list) {
-        hid_info(
-            hdev, "Report ID: %d, Max Fields: %d, Max Field Size: %d\n",
-            report->id, report->maxfield, report->maxfield
-        );
-        for (int i = 0; i < report->maxfield; i++) {
-            struct hid_field *field = report->field[i];
-            hid_info(
-                hdev, "Field %d: Size: %d, Offset: %d, Report Count: %d\n",
-                i, field->report_size, field->report_offset, field->report_count
-            );
-            if (field->report_count > 0)
-                hid_info(
-                    hdev, "Field %d has %d report counts\n",
-                    i, field->report_count
-                );
-        }
-    }*/
+    WRITE_ONCE(stats->requests, stats->requests + 1);
+}
+
+// Sends every command of a poll cycle, the transport queues them back to back
+static void vxe_request_all(struct vxe_mouse *vxe_dev) {
+    for (int i = 0; i < VXE_COMMAND_COUNT; i++)
+        vxe_request(vxe_dev, i);
+}
+
+// Has the tick poll a transport once it has dropped vxe_batteries_lock. Called with it held.
+static void vxe_queue_send(struct vxe_mouse *vxe_dev) {
+    if (list_empty(&vxe_dev->send_node))
+        list_add_tail(&vxe_dev->send_node, &vxe_send_queue);
+}
+
+/*
+ * Waits for the tick to finish sending, so a transport that has just been
+ * suspended or deactivated under vxe_batteries_lock is left alone from here
+ * on. Must be called without vxe_batteries_lock held.
+ */
+static void vxe_wait_for_sends(void) {
+    mutex_lock(&vxe_send_lock);
+    mutex_unlock(&vxe_send_lock);
+}
+
+/*
+ * Matches a response to the outstanding request of its command.
+ * Returns the request to response latency in microseconds, or -1 if there
+ * was no outstanding request.
+ */
+static s64 vxe_response_received(struct vxe_mouse *vxe_dev, enum vxe_command_index index) {
+    struct vxe_stats *stats = &vxe_dev->stats;
+    u64 sent = atomic64_xchg(&stats->request_sent_ns[index], 0);
+    u64 latency_us;
+
+    if (!sent) {
+        WRITE_ONCE(stats->duplicates, stats->duplicates + 1);
+        return -1;
+    }
+
+    latency_us = div_u64(ktime_get_ns() - sent, NSEC_PER_USEC);
+    unsigned int bucket = min_t(unsigned int, fls64(latency_us), LATENCY_BUCKETS - 1);
+    WRITE_ONCE(stats->latency_hist[bucket], stats->latency_hist[bucket] + 1);
+    WRITE_ONCE(stats->responses, stats->responses + 1);
+    return latency_us;
+}
+
+// Counts and traces a vendor report the driver could not make sense of
+static void vxe_bad_report(struct vxe_mouse *vxe_dev, u8 *data, int size) {
+    struct vxe_stats *stats = &vxe_dev->stats;
+
+    trace_vxe_bad_report(vxe_dev->hdev, data, size);
+    WRITE_ONCE(stats->malformed, stats->malformed + 1);
+    WRITE_ONCE(stats->last_error, -EPROTO);
+}
+
+static int vxe_stats_show(struct seq_file *m, void *unused) {
+    struct vxe_mouse *vxe_dev = m->private;
+    struct vxe_stats *stats = &vxe_dev->stats;
+    int outstanding = 0;
+
+    for (int i = 0; i < VXE_COMMAND_COUNT; i++)
+        outstanding += atomic64_read(&stats->request_sent_ns[i]) != 0;
+
+    seq_printf(m, "requests:    %lu\n", READ_ONCE(stats->requests));
+    seq_printf(m, "responses:   %lu\n", READ_ONCE(stats->responses));
+    seq_printf(m, "outstanding: %d\n", outstanding);
+    seq_printf(m, "lost:        %lu\n", READ_ONCE(stats->lost));
+    seq_printf(m, "duplicates:  %lu\n", READ_ONCE(stats->duplicates));
+    seq_printf(m, "malformed:   %lu\n", READ_ONCE(stats->malformed));
+    seq_printf(m, "last_error:  %d\n", READ_ONCE(stats->last_error));
+    seq_printf(m, "first_sample_us: %lu\n", READ_ONCE(stats->first_sample_us));
+    seq_printf(m, "suspends:    %lu\n", READ_ONCE(stats->suspends));
+    seq_printf(m, "resumes:     %lu\n", READ_ONCE(stats->resumes));
+    seq_printf(m, "polls_skipped_suspended: %lu\n", READ_ONCE(stats->polls_skipped));
+    seq_printf(m, "requests_while_suspended: %lu\n", READ_ONCE(stats->suspended_requests));
+    seq_printf(m, "retries:     %lu\n", READ_ONCE(stats->retries));
+    seq_printf(m, "timeouts:    %lu\n", READ_ONCE(stats->timeouts));
+
+    seq_puts(m, "latency_us:\n");
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        unsigned long count = READ_ONCE(stats->latency_hist[i]);
+
+        if (!count)
+            continue;
+        if (i == LATENCY_BUCKETS - 1)
+            seq_printf(m, "  >=%-9llu %lu\n", 1ULL << (i - 1), count);
+        else
+            seq_printf(m, "  <%-10llu %lu\n", 1ULL << i, count);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(vxe_stats);
+
+static int vxe_battery_register(struct vxe_battery *battery, struct vxe_mouse *parent);
+
+/*
+ * Emits a power supply uevent after the battery state has changed.
+ * Scheduled from the report handler, which runs in the HID input path.
+ * A battery without a power supply gets it registered here instead, either
+ * on its first reading or once FIRST_SAMPLE_DEADLINE_MS is up.
+ */
+static void vxe_battery_changed_work_handler(struct work_struct *work) {
+    struct vxe_battery *battery = container_of(to_delayed_work(work), struct vxe_battery, battery_changed_work);
+
+    // The power supply is re-registered when its parent transport goes away
+    mutex_lock(&vxe_batteries_lock);
+    if (battery->power_supply)
+        power_supply_changed(battery->power_supply);
+    else if (battery->active)
+        vxe_battery_register(battery, battery->active); // Retried on the next change if it fails
+    mutex_unlock(&vxe_batteries_lock);
+}
 
-    report = list_first_entry(report_list, struct hid_report, list);
-    if (report->id != REPORT_ID) {
-        hid_err(hdev, "invalid report id\n");
+/*
+ * Picks the delay until the next poll based on what the battery did since the
+ * previous one. A charging or changing battery is polled at poll_min_ms, a
+ * battery that keeps reporting the same values backs off exponentially
+ * up to poll_max_ms.
+ */
+static unsigned int vxe_next_poll_interval(struct vxe_battery *vxe_bat) {
+    unsigned int min_ms = max_t(unsigned int, READ_ONCE(poll_min_ms), BATTERY_POLL_FLOOR_MS);
+    unsigned int max_ms = max(READ_ONCE(poll_max_ms), min_ms);
+    struct vxe_battery_sample battery;
+    unsigned int interval;
+
+    vxe_battery_read(vxe_bat, &battery);
+
+    if (battery.capacity < 0) {
+        // No reading yet, the last request may have been lost
+        vxe_bat->retry_ms = vxe_bat->retry_ms ? min(vxe_bat->retry_ms * 2, min_ms) : FIRST_RETRY_MS;
+        return vxe_bat->retry_ms;
+    }
+
+    if (battery.status == POWER_SUPPLY_STATUS_CHARGING ||
+        battery.capacity != vxe_bat->polled_capacity || battery.status != vxe_bat->polled_status)
+        interval = min_ms;
+    else
+        interval = min(vxe_bat->poll_interval_ms * 2, max_ms);
+    interval = max(interval, min_ms);
+
+    vxe_bat->polled_capacity = battery.capacity;
+    vxe_bat->polled_status = battery.status;
+    // Account for the polls a fixed poll_min_ms schedule would have made
+    WRITE_ONCE(vxe_bat->wakeups_saved, vxe_bat->wakeups_saved + interval / min_ms - 1);
+    return interval;
+}
+
+/*
+ * Turns a poll interval into the delay until the next poll. Mice that were
+ * plugged in together, e.g. after a USB hub reset, would otherwise poll in
+ * lockstep forever: the first regular poll is placed at a random point of the
+ * interval and every later one is jittered by +-1/8 of it.
+ */
+static unsigned long vxe_poll_delay(struct vxe_battery *battery, unsigned int interval) {
+    // Retries for the first reading are kept short
+    if (interval < BATTERY_POLL_FLOOR_MS)
+        return msecs_to_jiffies(interval);
+
+    if (!battery->phased) {
+        battery->phased = true;
+        interval = BATTERY_POLL_FLOOR_MS + get_random_u32_below(interval - BATTERY_POLL_FLOOR_MS + 1);
+    } else {
+        interval = interval - interval / 8 + get_random_u32_below(interval / 4 + 1);
+    }
+    return msecs_to_jiffies(interval);
+}
+
+/*
+ * Queues a regular poll and starts waiting for its answer, see
+ * vxe_battery_check_request. Called with vxe_batteries_lock held.
+ */
+static void vxe_battery_send(struct vxe_battery *battery, unsigned int attempt) {
+    battery->request_seq = READ_ONCE(battery->history_seq);
+    vxe_queue_send(battery->active);
+    battery->request_attempt = attempt;
+    battery->request_deadline = jiffies + msecs_to_jiffies(REQUEST_TIMEOUT_MS << attempt);
+    battery->request_pending = true;
+}
+
+/*
+ * Resends a regular poll that wasn't answered in time, waiting twice as long
+ * for every retry. After REQUEST_RETRIES the mouse is left alone until the
+ * next regular poll, so one that is asleep or out of range isn't hammered.
+ * Called from the tick with vxe_batteries_lock held.
+ */
+static void vxe_battery_check_request(struct vxe_battery *battery, unsigned long now) {
+    struct vxe_stats *stats = &battery->active->stats;
+
+    if (!battery->request_pending)
+        return;
+
+    // Any new sample answers it, the response handler doesn't take the lock
+    if (READ_ONCE(battery->history_seq) != battery->request_seq || battery->active->suspended) {
+        battery->request_pending = false;
         return;
     }
+    if (time_before(now, battery->request_deadline))
+        return;
 
-    if (report->field[0]->report_count < 16) {
-        hid_err(hdev, "not enough values in the field\n");
+    if (battery->request_attempt < REQUEST_RETRIES) {
+        WRITE_ONCE(stats->retries, stats->retries + 1);
+        vxe_battery_send(battery, battery->request_attempt + 1);
         return;
     }
 
-    report->field[0]->value[0] = 0x04; // Command
-    report->field[0]->value[15] = 0x49; // Checksum
+    battery->request_pending = false;
+    WRITE_ONCE(stats->timeouts, stats->timeouts + 1);
+    hid_dbg(battery->active->hdev, "No battery response after %d retries\n", REQUEST_RETRIES);
+}
+
+/*
+ * Tells userspace once the last reading has become too old, so the status
+ * turns unknown and the supply offline. The report handler clears the flag
+ * and notifies again with the next reading. Called with vxe_batteries_lock held.
+ */
+static void vxe_battery_check_stale(struct vxe_battery *battery) {
+    struct vxe_battery_sample sample;
+
+    if (READ_ONCE(battery->stale))
+        return;
 
-    hid_hw_request(hdev, report, HID_REQ_SET_REPORT);
-    hid_info(hdev, "hw_request sent for battery status\n");
+    vxe_battery_read(battery, &sample);
+    if (vxe_battery_sample_stale(&sample)) {
+        WRITE_ONCE(battery->stale, true);
+        mod_delayed_work(system_wq, &battery->battery_changed_work, 0);
+    }
 }
 
 /*
- * Timer callback function to periodically request battery status.
- * This function is called by the kernel timer when it expires.
+ * Finds when the last reading turns stale, so the tick comes back for
+ * vxe_battery_check_stale even when no poll is scheduled, as in lazy mode.
+ * Returns false if there is nothing to wait for. Called from the tick with
+ * vxe_batteries_lock held, after vxe_battery_check_stale.
  */
-static void vxe_request_battery_status(struct timer_list *t) {
-    // Get the containing vxe_mouse structure from the timer_list
-    struct vxe_mouse *vxe_dev = from_timer(vxe_dev, t, battery_poll_timer);
-    // Schedule the work item to run the actual HID request in a process context
-    schedule_work(&vxe_dev->battery_request_work);
-    // Reschedule the timer to run again after BATTERY_POLL_INTERVAL_MS
-    mod_timer(&vxe_dev->battery_poll_timer, jiffies + msecs_to_jiffies(BATTERY_POLL_INTERVAL_MS));
+static bool vxe_battery_stale_deadline(struct vxe_battery *battery, unsigned long now, unsigned long *deadline) {
+    unsigned int max_age_ms = READ_ONCE(stale_ms);
+    struct vxe_battery_sample sample;
+    s64 age_ms;
+
+    // A stale battery is only brought back by a new reading
+    if (!max_age_ms || READ_ONCE(battery->stale))
+        return false;
+
+    vxe_battery_read(battery, &sample);
+    if (sample.capacity < 0)
+        return false;
+
+    age_ms = ktime_ms_delta(ktime_get_boottime(), sample.timestamp);
+    *deadline = now + msecs_to_jiffies(age_ms < max_age_ms ? max_age_ms - age_ms + 1 : 0);
+    return true;
 }
 
-/**
- * Initializes the device, sets up the workqueue and timer for battery polling on interface 1.
- * This function is called when the HID device is probed.
+/*
+ * Requests the battery status over the active transport and schedules the
+ * next poll. Called from the tick with vxe_batteries_lock held.
  */
-static int vxe_probe(struct hid_device *hdev, const struct hid_device_id *id) {
-    // Get the current USB interface number
+static void vxe_battery_poll(struct vxe_battery *battery) {
+    unsigned int interval;
+
+    battery->poll_scheduled = false;
+    if (battery->active->suspended) {
+        // Never wake a sleeping device up for a poll, vxe_resume
+        // restarts polling once it is awake again
+        struct vxe_stats *stats = &battery->active->stats;
+
+        WRITE_ONCE(stats->polls_skipped, stats->polls_skipped + 1);
+        battery->poll_missed = true;
+        return;
+    }
+    interval = vxe_next_poll_interval(battery);
+    // Retries for the first reading come around quicker than any timeout
+    if (interval < BATTERY_POLL_FLOOR_MS)
+        vxe_queue_send(battery->active);
+    else
+        vxe_battery_send(battery, 0);
+
+    // In lazy mode only the first reading is polled for, readers
+    // ask for everything after it through vxe_battery_refresh
+    struct vxe_battery_sample sample;
+    vxe_battery_read(battery, &sample);
+    if (READ_ONCE(lazy_ttl_ms) && sample.capacity >= 0)
+        return;
+
+    WRITE_ONCE(battery->poll_interval_ms, interval);
+    battery->next_poll = jiffies + vxe_poll_delay(battery, interval);
+    battery->poll_slack = interval < BATTERY_POLL_FLOOR_MS ? 0 : msecs_to_jiffies(POLL_BATCH_MS);
+    battery->poll_scheduled = true;
+}
+
+/*
+ * Polls every battery that is due and sleeps until the next one is. Polls
+ * due within their slack are sent in the same tick, so mice whose polls end
+ * up close together cost one wakeup. The work is deferrable and the
+ * workqueue power efficient, so on an idle system the tick waits for the CPU
+ * to wake up for something else instead of waking it up on its own.
+ *
+ * The polls are decided under vxe_batteries_lock but sent after dropping
+ * it, so a mouse that doesn't acknowledge a transfer doesn't hold up probe,
+ * remove or the power supply of every other mouse.
+ */
+static void vxe_poll_tick(struct work_struct *work) {
+    unsigned long now = jiffies, next = 0, stale_deadline;
+    struct vxe_battery *battery;
+    struct vxe_mouse *vxe_dev, *tmp;
+    bool pending = false;
+
+    mutex_lock(&vxe_batteries_lock);
+    list_for_each_entry(battery, &vxe_batteries, list) {
+        // Polling is restarted by vxe_battery_attach once a transport shows up
+        if (!battery->active)
+            continue;
+
+        vxe_battery_check_request(battery, now);
+        if (xchg(&battery->poll_now, false) ||
+            (battery->poll_scheduled && time_before_eq(battery->next_poll, now + battery->poll_slack)))
+            vxe_battery_poll(battery);
+        vxe_battery_check_stale(battery);
+
+        if (battery->poll_scheduled && (!pending || time_before(battery->next_poll, next))) {
+            next = battery->next_poll;
+            pending = true;
+        }
+        if (battery->request_pending && (!pending || time_before(battery->request_deadline, next))) {
+            next = battery->request_deadline;
+            pending = true;
+        }
+        if (vxe_battery_stale_deadline(battery, now, &stale_deadline) &&
+            (!pending || time_before(stale_deadline, next))) {
+            next = stale_deadline;
+            pending = true;
+        }
+    }
+
+    // Suspend and remove can't get past vxe_wait_for_sends before the
+    // queued transports have been sent to, so they stay around until then
+    mutex_lock(&vxe_send_lock);
+    mutex_unlock(&vxe_batteries_lock);
+    list_for_each_entry_safe(vxe_dev, tmp, &vxe_send_queue, send_node) {
+        list_del_init(&vxe_dev->send_node);
+        vxe_request_all(vxe_dev);
+    }
+    mutex_unlock(&vxe_send_lock);
+
+    // Doesn't move the tick if it was kicked by vxe_battery_poll_soon meanwhile
+    if (pending)
+        queue_delayed_work(vxe_wq, &vxe_tick_work, time_after(next, jiffies) ? next - jiffies : 0);
+}
+
+/*
+ * Registers the power supply of the battery with the given transport as its
+ * parent device. Called with vxe_batteries_lock held.
+ */
+static int vxe_battery_register(struct vxe_battery *battery, struct vxe_mouse *parent) {
+    struct power_supply_config psy_cfg = {
+        .drv_data = battery,
+        .attr_grp = vxe_battery_groups,
+    };
+    struct power_supply *psy;
+
+    // The registration uevent reads every property with vxe_batteries_lock
+    // held, so the tick couldn't send a refresh. Reads report the cached
+    // sample meanwhile instead of waiting out lazy_wait_ms.
+    WRITE_ONCE(battery->registering, true);
+    psy = power_supply_register(&parent->hdev->dev, &battery->psy_desc, &psy_cfg);
+    WRITE_ONCE(battery->registering, false);
+    if (IS_ERR(psy)) {
+        hid_err(parent->hdev, "Failed to register power supply: %ld\n", PTR_ERR(psy));
+        return PTR_ERR(psy);
+    }
+
+    battery->power_supply = psy;
+    battery->psy_parent = parent;
+    return 0;
+}
+
+/*
+ * Makes the most preferred live transport the active one, the wired link wins
+ * over the dongle. Called with vxe_batteries_lock held, returns true if the
+ * active transport has changed. Once this returns, the previous transport's
+ * report handler can't store a sample anymore, see vxe_battery_update.
+ */
+static bool vxe_battery_pick_active(struct vxe_battery *battery) {
+    struct vxe_mouse *active = NULL;
+    unsigned long flags;
+
+    for (int i = 0; i < VXE_TRANSPORT_COUNT; i++) {
+        if (battery->transports[i]) {
+            active = battery->transports[i];
+            break;
+        }
+    }
+
+    if (active == battery->active)
+        return false;
+
+    // Doesn't change the sample, readers needn't retry
+    read_seqlock_excl_irqsave(&battery->battery_lock, flags);
+    WRITE_ONCE(battery->active, active);
+    read_sequnlock_excl_irqrestore(&battery->battery_lock, flags);
+    return true;
+}
+
+// Allocates a battery for a mouse seen for the first time
+VISIBLE_IF_KUNIT struct vxe_battery *vxe_battery_create(struct vxe_mouse *vxe_dev) {
+    struct hid_device *hdev = vxe_dev->hdev;
+    struct vxe_battery *battery;
+
+    battery = kzalloc(sizeof(*battery), GFP_KERNEL);
+    if (!battery)
+        return NULL;
+
+    strscpy(battery->uniq, hdev->uniq, sizeof(battery->uniq));
+
+    // Initialize battery status fields with an unknown state
+    seqlock_init(&battery->battery_lock);
+    init_waitqueue_head(&battery->sample_wait);
+    battery->battery.capacity = -1;
+    battery->battery.status = POWER_SUPPLY_STATUS_UNKNOWN;
+    battery->battery.voltage = 0;
+    battery->battery.time_to_empty = -1;
+    battery->battery.time_to_full = -1;
+    battery->anchor.capacity = -1;
+    ewma_vxe_rate_init(&battery->discharge_rate);
+    ewma_vxe_rate_init(&battery->charge_rate);
+    ewma_vxe_rate_init(&battery->uv_per_pct);
+    battery->polled_capacity = -1;
+    battery->polled_status = POWER_SUPPLY_STATUS_UNKNOWN;
+
+    INIT_DELAYED_WORK(&battery->battery_changed_work, vxe_battery_changed_work_handler);
+
+    // The name stays the same for the lifetime of the battery, even when
+    // the power supply moves over to the other transport
+    snprintf(battery->psy_name, sizeof(battery->psy_name),
+             "vxe_%04x_%04x_bat_%d", hdev->vendor, hdev->product, TARGET_INTERFACE);
+
+    battery->psy_desc.name = battery->psy_name;
+    battery->psy_desc.type = POWER_SUPPLY_TYPE_BATTERY;
+    battery->psy_desc.properties = vxe_power_supply_props;
+    battery->psy_desc.num_properties = ARRAY_SIZE(vxe_power_supply_props);
+    battery->psy_desc.get_property = vxe_power_supply_get_property;
+    battery->psy_desc.set_property = NULL;
+
+    return battery;
+}
+EXPORT_SYMBOL_IF_KUNIT(vxe_battery_create);
+
+VISIBLE_IF_KUNIT void vxe_battery_free(struct vxe_battery *battery) {
+    kfree(battery);
+}
+EXPORT_SYMBOL_IF_KUNIT(vxe_battery_free);
+
+/*
+ * Attaches a transport to the battery of its mouse, creating the battery if
+ * this is the first transport of the mouse. The first query goes out right
+ * away, the power supply is registered once it has been answered.
+ *
+ * Mice are told apart by hdev->uniq. A transport without one can't be told
+ * apart from another mouse, so it always gets a battery of its own: merging
+ * two different mice would leave one of them without a power supply.
+ */
+static int vxe_battery_attach(struct vxe_mouse *vxe_dev) {
+    const char *uniq = vxe_dev->hdev->uniq;
+    struct vxe_battery *battery;
+    bool found = false;
+
+    mutex_lock(&vxe_batteries_lock);
+
+    list_for_each_entry(battery, &vxe_batteries, list) {
+        if (uniq[0] && !battery->transports[vxe_dev->transport] && !strcmp(battery->uniq, uniq)) {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        battery = vxe_battery_create(vxe_dev);
+        if (!battery) {
+            mutex_unlock(&vxe_batteries_lock);
+            return -ENOMEM;
+        }
+    }
+
+    if (!found)
+        list_add_tail(&battery->list, &vxe_batteries);
+
+    vxe_dev->battery = battery;
+    battery->transports[vxe_dev->transport] = vxe_dev;
+    battery->users++;
+
+    // Associate custom data with the HID device, so it can be retrieved later.
+    // This is done under the lock, so vxe_raw_event sees a fully attached
+    // device before the first request can go out over this transport.
+    hid_set_drvdata(vxe_dev->hdev, vxe_dev);
+
+    // Query the newly preferred transport right away, the probe has
+    // already started I/O so the response can't be missed
+    if (vxe_battery_pick_active(battery))
+        vxe_battery_poll_soon(battery);
+
+    // A new battery, or one left without a power supply by a removed
+    // transport, gets it registered once there is a reading to show
+    if (!battery->power_supply)
+        queue_delayed_work(system_wq, &battery->battery_changed_work,
+                           battery->battery.capacity < 0 ? msecs_to_jiffies(FIRST_SAMPLE_DEADLINE_MS) : 0);
+
+    mutex_unlock(&vxe_batteries_lock);
+
+    if (found)
+        hid_info(vxe_dev->hdev, "Sharing battery %s with the other transport\n", battery->psy_name);
+    return 0;
+}
+
+/*
+ * Stops polling over a transport that is going away and fails over to the
+ * other transport of the mouse, if there is one. The transport still holds
+ * its reference to the battery until vxe_battery_put, as reports can keep
+ * arriving until the hardware is stopped.
+ */
+static void vxe_battery_deactivate(struct vxe_mouse *vxe_dev) {
+    struct vxe_battery *battery = vxe_dev->battery;
+
+    mutex_lock(&vxe_batteries_lock);
+    battery->transports[vxe_dev->transport] = NULL;
+    if (vxe_battery_pick_active(battery) && battery->active) {
+        hid_info(battery->active->hdev, "Battery polling failed over to this transport\n");
+        vxe_battery_poll_soon(battery);
+    }
+    mutex_unlock(&vxe_batteries_lock);
+
+    // The hardware is stopped next, a poll in flight must be done by then
+    vxe_wait_for_sends();
+}
+
+/*
+ * Drops the reference a stopped transport holds to its battery. The power
+ * supply is moved over to the active transport if it was registered on this
+ * one, and the battery is freed once no transport uses it anymore.
+ */
+static void vxe_battery_put(struct vxe_mouse *vxe_dev) {
+    struct vxe_battery *battery = vxe_dev->battery;
+    bool last;
+
+    mutex_lock(&vxe_batteries_lock);
+
+    if (battery->psy_parent == vxe_dev) {
+        power_supply_unregister(battery->power_supply);
+        battery->power_supply = NULL;
+        battery->psy_parent = NULL;
+        // Failure is not fatal, the next attached transport tries again
+        if (battery->active)
+            vxe_battery_register(battery, battery->active);
+    }
+
+    last = --battery->users == 0;
+    if (last)
+        list_del(&battery->list);
+
+    mutex_unlock(&vxe_batteries_lock);
+
+    if (last) {
+        // Nothing can queue the work anymore, and the tick no longer sees the battery
+        cancel_delayed_work_sync(&battery->battery_changed_work);
+        vxe_battery_free(battery);
+    }
+}
+
+/*
+ * Returns the USB interface number of the HID device. Virtual devices, such
+ * as the uhid simulator in testing/, have no USB interface, for those the
+ * battery interface is recognized by its vendor output report instead.
+ * Must be called after hid_parse.
+ */
+static int vxe_interface_number(struct hid_device *hdev) {
+    if (!hid_is_usb(hdev))
+        return hdev->report_enum[HID_OUTPUT_REPORT].report_id_hash[REPORT_ID] ? TARGET_INTERFACE : -1;
+
     struct usb_interface *intf = to_usb_interface(hdev->dev.parent);
-    int ifnum = intf->cur_altsetting->desc.bInterfaceNumber;
+    return intf->cur_altsetting->desc.bInterfaceNumber;
+}
 
+/**
+ * Starts every interface of the mouse. On the battery interface (interface 1)
+ * it also prebuilds the vendor queries, starts I/O early and attaches the
+ * transport to the battery of its mouse, which has the shared tick send the
+ * first query right away. The power supply is registered later, with the
+ * first reading. This function is called when the HID device is probed.
+ */
+static int vxe_probe(struct hid_device *hdev, const struct hid_device_id *id) {
     // Parse the HID descriptor
     int ret = hid_parse(hdev);
     if (ret) {
@@ -186,6 +1068,9 @@ static int vxe_probe(struct hid_device *hdev, const struct hid_device_id *id) {
         return ret;
     }
 
+    // Get the current interface number
+    int ifnum = vxe_interface_number(hdev);
+
     // Start the HID hardware for I/O operations
     ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT);
     if (ret) {
@@ -193,7 +1078,9 @@ static int vxe_probe(struct hid_device *hdev, const struct hid_device_id *id) {
         return ret;
     }
 
-    // Only set up battery polling on the specific interface we care about
+    // Only set up battery polling on the specific interface we care about.
+    // The interface role is resolved here once: only the battery interface
+    // gets driver data, which is all vxe_raw_event needs to look at.
     if (ifnum == TARGET_INTERFACE) {
         hid_info(
             hdev,
@@ -211,120 +1098,321 @@ static int vxe_probe(struct hid_device *hdev, const struct hid_device_id *id) {
         }
         // Store the hid_device pointer in the custom structure
         vxe_dev->hdev = hdev;
-        // Associate custom data with the HID device, so it can be retrieved later
-        hid_set_drvdata(hdev, vxe_dev);
-
-        snprintf(vxe_dev->psy_name, sizeof(vxe_dev->psy_name),
-                  "vxe_%04x_%04x_bat_%d", id->vendor, id->product, ifnum);
+        vxe_dev->transport = id->driver_data;
+        vxe_dev->stats.attached = ktime_get();
+        INIT_LIST_HEAD(&vxe_dev->send_node);
 
-        // Initialize the power supply description structure dynamically
-        struct power_supply_desc *desc = devm_kzalloc(&hdev->dev, sizeof(*desc), GFP_KERNEL);
-        if (!desc) {
-            hid_err(hdev, "Failed to allocate power_supply_desc\n");
-            hid_hw_stop(hdev);
-            return -ENOMEM;
+        // Without the vendor report there is no battery to poll, but the
+        // interface also carries the media keys, so it stays bound
+        ret = vxe_prepare_requests(vxe_dev);
+        if (ret) {
+            hid_err(hdev, "Failed to prepare battery queries: %d, battery reporting disabled\n", ret);
+            kfree(vxe_dev);
+            return 0;
         }
 
-        desc->name = vxe_dev->psy_name;
-        desc->type = POWER_SUPPLY_TYPE_BATTERY;
-        desc->properties = vxe_power_supply_props;
-        desc->num_properties = ARRAY_SIZE(vxe_power_supply_props);
-        desc->get_property = vxe_power_supply_get_property;
-        desc->set_property = NULL;
-
-        struct power_supply_config psy_cfg = {
-            .drv_data = vxe_dev,
-        };
-
-        vxe_dev->power_supply = devm_power_supply_register(&hdev->dev, desc, &psy_cfg);
-        if (IS_ERR(vxe_dev->power_supply)) {
-            ret = PTR_ERR(vxe_dev->power_supply);
-            hid_err(hdev, "Failed to register power supply: %d\n", ret);
-            kfree(vxe_dev);
+        // Let reports through before probe returns, so the response to the
+        // first query, sent as soon as the battery is attached, gets handled
+        hid_device_io_start(hdev);
+
+        // Join the battery of the mouse, its power supply follows with the first reading
+        ret = vxe_battery_attach(vxe_dev);
+        if (ret) {
+            hid_err(hdev, "Failed to set up battery: %d\n", ret);
+            hid_device_io_stop(hdev);
             hid_hw_stop(hdev);
+            kfree(vxe_dev->requests);
+            kfree(vxe_dev);
             return ret;
         }
 
-        // Initialize battery status fields with an unknown state
-        vxe_dev->battery_capacity = -1;
-        vxe_dev->battery_status = POWER_SUPPLY_STATUS_UNKNOWN;
-        vxe_dev->battery_voltage = 0;
-
-        // Initialize the workqueue item with a handler function.
-        INIT_WORK(&vxe_dev->battery_request_work, vxe_battery_work_handler);
-        // Initialize the timer
-        timer_setup(&vxe_dev->battery_poll_timer, vxe_request_battery_status, 0);
-
-        // Start the timer immediately to get the first battery status
-        // It reschedule itself periodically in the callback
-        mod_timer(&vxe_dev->battery_poll_timer, jiffies + msecs_to_jiffies(100));
+        // Query statistics live next to the other HID debugfs files of the device
+        if (hdev->debug_dir)
+            vxe_dev->debugfs = debugfs_create_file("vxe_battery", 0444, hdev->debug_dir,
+                                                   vxe_dev, &vxe_stats_fops);
     }
 
     // Return 0 to indicate a successful probe
     return 0;
 }
 
-static int vxe_raw_event(
+// Converts a decoded battery response into a sample
+static struct vxe_battery_sample vxe_battery_sample_from_info(const struct vxe_battery_info *info, ktime_t timestamp) {
+    return (struct vxe_battery_sample) {
+        .capacity = info->level,
+        .status = vxe_battery_charging(info) ? POWER_SUPPLY_STATUS_CHARGING : POWER_SUPPLY_STATUS_DISCHARGING,
+        .voltage = info->voltage_mv,
+        .timestamp = timestamp,
+    };
+}
+
+/*
+ * Decides whether userspace should hear about a new sample. Voltage is
+ * compared against the value of the last notification, so a slow drift is
+ * reported once it adds up to the hysteresis.
+ */
+VISIBLE_IF_KUNIT bool vxe_battery_sample_changed(const struct vxe_battery_sample *old,
+                                                 const struct vxe_battery_sample *new,
+                                                 int notified_voltage, unsigned int hysteresis_mv) {
+    return new->capacity != old->capacity ||
+           new->status != old->status ||
+           abs(new->voltage - notified_voltage) >= (int)hysteresis_mv;
+}
+EXPORT_SYMBOL_IF_KUNIT(vxe_battery_sample_changed);
+
+/*
+ * Updates the charge and discharge rate estimates with a new sample and fills
+ * in its time to empty and time to full. O(1) and integer only, as it runs in
+ * the report handler.
+ *
+ * The level only moves in 1% steps, so a rate is measured between two steps.
+ * While discharging, the voltage drop since the last step, scaled by the
+ * learned voltage drop per percent, places the battery within the current
+ * percent. The voltage is not used while charging, the charge current
+ * lifts it too much to say anything about the level.
+ */
+static void vxe_battery_estimate(struct vxe_battery *battery, struct vxe_battery_sample *sample) {
+    struct vxe_battery_sample *anchor = &battery->anchor;
+    bool discharging = sample->status == POWER_SUPPLY_STATUS_DISCHARGING;
+    struct ewma_vxe_rate *rate = discharging ? &battery->discharge_rate : &battery->charge_rate;
+    int steps = abs(sample->capacity - anchor->capacity);
+
+    sample->time_to_empty = -1;
+    sample->time_to_full = -1;
+
+    if (anchor->capacity < 0 || sample->status != anchor->status) {
+        // Start over, the time since the last step is unknown
+        *anchor = *sample;
+        battery->anchor_is_step = false;
+        return;
+    }
+
+    if (steps) {
+        s64 elapsed_ms = ktime_ms_delta(sample->timestamp, anchor->timestamp);
+
+        // Only a full step to step interval says how long a percent takes
+        if (battery->anchor_is_step && elapsed_ms > 0) {
+            ewma_vxe_rate_add(rate, div64_u64((u64)steps * 1000 * MSEC_PER_SEC * 3600, elapsed_ms));
+            if (discharging && anchor->voltage > sample->voltage)
+                ewma_vxe_rate_add(&battery->uv_per_pct, (anchor->voltage - sample->voltage) * 1000 / steps);
+        }
+        *anchor = *sample;
+        battery->anchor_is_step = true;
+    }
+
+    unsigned long milli_pct_per_hour = ewma_vxe_rate_read(rate);
+    if (!milli_pct_per_hour)
+        return;
+
+    // Level in milli-percent
+    int level = sample->capacity * 1000;
+    if (discharging) {
+        unsigned long uv_per_pct = ewma_vxe_rate_read(&battery->uv_per_pct);
+
+        if (uv_per_pct && anchor->voltage > sample->voltage)
+            level -= min_t(unsigned long, (anchor->voltage - sample->voltage) * 1000UL * 1000 / uv_per_pct, 999);
+        sample->time_to_empty = div_u64((u64)max(level, 0) * 3600, milli_pct_per_hour);
+    } else if (sample->status == POWER_SUPPLY_STATUS_CHARGING) {
+        sample->time_to_full = div_u64((u64)(100 * 1000 - level) * 3600, milli_pct_per_hour);
+    }
+}
+
+// Stores a battery response received on a transport
+static void vxe_battery_update(struct vxe_mouse *vxe_dev, const struct vxe_battery_info *info) {
+    struct vxe_battery *battery = vxe_dev->battery;
+    struct vxe_battery_sample sample = vxe_battery_sample_from_info(info, ktime_get_boottime());
+    unsigned long flags;
+
+    write_seqlock_irqsave(&battery->battery_lock, flags);
+
+    // Only the active transport may write the battery state. Responses on
+    // the other one can only come from a userspace tool querying it. The
+    // check is under the lock, so a transport that has just lost the battery
+    // to a failover can't race the new one.
+    if (battery->active != vxe_dev) {
+        write_sequnlock_irqrestore(&battery->battery_lock, flags);
+        return;
+    }
+
+    // The lock keeps out other writers, so the current sample can be read directly
+    bool changed = vxe_battery_sample_changed(&battery->battery, &sample, battery->notified_voltage,
+                                              READ_ONCE(voltage_hysteresis_mv));
+
+    // Back online after the reading went stale
+    if (READ_ONCE(battery->stale)) {
+        WRITE_ONCE(battery->stale, false);
+        changed = true;
+    }
+
+    vxe_battery_estimate(battery, &sample);
+    vxe_battery_store(battery, &sample);
+    if (changed)
+        battery->notified_voltage = sample.voltage;
+
+    write_sequnlock_irqrestore(&battery->battery_lock, flags);
+    vxe_battery_stored(battery);
+
+    // Only wake userspace up for changes it cares about
+    if (changed)
+        mod_delayed_work(system_wq, &battery->battery_changed_work, 0);
+}
+
+// Handles the response to VXE_CMD_BATTERY
+static void vxe_battery_response(struct vxe_mouse *vxe_dev, u8 *data, int size) {
+    struct vxe_battery_info info;
+
+    if (vxe_parse_battery(data, size, &info)) {
+        vxe_bad_report(vxe_dev, data, size);
+        return;
+    }
+
+    s64 latency_us = vxe_response_received(vxe_dev, VXE_COMMAND_BATTERY);
+
+    // Time from plugging in to the first usable battery level
+    if (unlikely(!vxe_dev->stats.first_sample_us)) {
+        unsigned long first_us = max_t(s64, ktime_us_delta(ktime_get(), vxe_dev->stats.attached), 1);
+
+        WRITE_ONCE(vxe_dev->stats.first_sample_us, first_us);
+        hid_info(vxe_dev->hdev, "First battery reading %lu ms after probe\n", first_us / USEC_PER_MSEC);
+    }
+    trace_vxe_battery_response(vxe_dev->hdev, info.level, info.charge, info.voltage_mv, latency_us);
+    hid_dbg(vxe_dev->hdev, "Battery: level %d%%, charge state %d, voltage %d mV\n",
+            info.level, info.charge, info.voltage_mv);
+
+    vxe_battery_update(vxe_dev, &info);
+}
+
+/*
+ * Handles the vendor report (ID 0x08) which carries responses to the commands
+ * sent from vxe_battery_poll, dispatched by command ID.
+ */
+static void vxe_vendor_report(struct vxe_mouse *vxe_dev, u8 *data, int size) {
+    int command = vxe_report_command(data, size);
+
+    for (int i = 0; command >= 0 && i < VXE_COMMAND_COUNT; i++) {
+        if (vxe_commands[i].id == command) {
+            vxe_commands[i].handle_response(vxe_dev, data, size);
+            return;
+        }
+    }
+    vxe_bad_report(vxe_dev, data, size);
+}
+
+// Handlers for reports we care about, indexed by report ID.
+// Anything without an entry is regular input and is left to hid-input.
+static const vxe_report_handler vxe_report_handlers[HID_MAX_IDS] = {
+    [REPORT_ID] = vxe_vendor_report,
+};
+// Report IDs with an entry in vxe_report_handlers, all of them below 64
+#define VXE_HANDLED_REPORT_IDS BIT_ULL(REPORT_ID)
+
+VISIBLE_IF_KUNIT int vxe_raw_event(
     struct hid_device *hdev,
     struct hid_report *report,
     u8 *data, int size
 ) {
-    
-    struct usb_interface *intf = to_usb_interface(hdev->dev.parent);
-    int ifnum = intf->cur_altsetting->desc.bInterfaceNumber;
-    // Detect battery information packet
-    if (size == 17 && data[0] == 0x08 && data[1] == 0x04) {
-        struct vxe_mouse *vxe_dev = hid_get_drvdata(hdev);
-        hid_info(hdev, "vxe_raw_event: === Detected a 17-byte battery data packet! ===\n");
-        hid_info(hdev, "vxe_raw_event: Interface Number: %d\n", ifnum);
-
-        int batteryLevel = data[6];
-        int batteryCharge = data[7];
-        int voltage = (data[8] << 8) | data[9];
-
-        if (batteryCharge == 0x00) {
-            hid_info(hdev, "Battery Status: Not Charging\n");
-        } else if (batteryCharge == 0x01) {
-            hid_info(hdev, "Battery Status: Charging\n");
-        } else {
-            hid_info(hdev, "Battery Status: Unknown (%d)\n", batteryCharge);
-        }
+    struct vxe_mouse *vxe_dev;
+    vxe_report_handler handler;
+
+    // Pointer motion arrives here at the full polling rate (1 kHz), so
+    // everything that is not ours leaves on a check that touches no memory
+    // (see testing/bench-dispatch.c)
+    if (likely(report->id >= 64 || !(VXE_HANDLED_REPORT_IDS & BIT_ULL(report->id))))
+        return 0;
 
-        hid_info(hdev, "Battery Level: %d%%\n", batteryLevel);
-        hid_info(hdev, "Battery Voltage: %d mV\n", voltage);
+    // Driver data only exists on the battery interface, see vxe_probe
+    vxe_dev = hid_get_drvdata(hdev);
+    if (!vxe_dev)
+        return 0;
+
+    handler = vxe_report_handlers[report->id];
+    if (handler)
+        handler(vxe_dev, data, size);
+    return 0;
+}
+EXPORT_SYMBOL_IF_KUNIT(vxe_raw_event);
 
-        vxe_dev->battery_capacity = data[6];
-        vxe_dev->battery_status = (batteryCharge == 0x01) ? POWER_SUPPLY_STATUS_CHARGING : POWER_SUPPLY_STATUS_DISCHARGING;
-        vxe_dev->battery_voltage = voltage;
+#ifdef CONFIG_PM
+/*
+ * Called for system suspend as well as for USB runtime suspend of the
+ * interface. From here on the tick leaves the transport alone, a poll in
+ * progress is done once vxe_wait_for_sends returns. On system suspend the scheduled
+ * poll is also dropped, the freezable workqueue keeps the tick from running
+ * until everything has resumed.
+ */
+static int vxe_suspend(struct hid_device *hdev, pm_message_t message) {
+    struct vxe_mouse *vxe_dev = hid_get_drvdata(hdev);
+    struct vxe_battery *battery;
+
+    if (!vxe_dev)
+        return 0;
+    battery = vxe_dev->battery;
+
+    mutex_lock(&vxe_batteries_lock);
+    WRITE_ONCE(vxe_dev->suspended, true);
+    WRITE_ONCE(vxe_dev->stats.suspends, vxe_dev->stats.suspends + 1);
+    if (battery->active == vxe_dev && !PMSG_IS_AUTO(message)) {
+        battery->poll_scheduled = false;
+        battery->poll_missed = true;
     }
+    mutex_unlock(&vxe_batteries_lock);
+
+    vxe_wait_for_sends();
     return 0;
 }
 
+static int vxe_resume(struct hid_device *hdev) {
+    struct vxe_mouse *vxe_dev = hid_get_drvdata(hdev);
+    struct vxe_battery *battery;
+
+    if (!vxe_dev)
+        return 0;
+    battery = vxe_dev->battery;
+
+    mutex_lock(&vxe_batteries_lock);
+    WRITE_ONCE(vxe_dev->suspended, false);
+    WRITE_ONCE(vxe_dev->stats.resumes, vxe_dev->stats.resumes + 1);
+    // Refresh right away instead of reporting the state from before the
+    // suspend for another full interval
+    if (battery->active == vxe_dev && battery->poll_missed) {
+        battery->poll_missed = false;
+        vxe_battery_poll_soon(battery);
+    }
+    mutex_unlock(&vxe_batteries_lock);
+    return 0;
+}
+
+// The driver sets nothing up on the mouse, so there is nothing to restore after a reset
+static int vxe_reset_resume(struct hid_device *hdev) {
+    return vxe_resume(hdev);
+}
+#endif
+
 static void vxe_remove(struct hid_device *hdev) {
     pr_info("vxe_remove: Device being removed.\n");
     
-    // Stop new work/timers and wait for existing work to finish
+    // Stop polling over this transport, the other one takes over if present
     struct vxe_mouse *vxe_dev = hid_get_drvdata(hdev);
     if (vxe_dev) {
-        // Delete the timer if it was active
-        del_timer_sync(&vxe_dev->battery_poll_timer);
-        // Cancel any pending workqueue items and wait for them to complete
-        cancel_work_sync(&vxe_dev->battery_request_work);
+        debugfs_remove(vxe_dev->debugfs);
+        vxe_battery_deactivate(vxe_dev);
     }
 
     // Stop the HID hardware operations
     hid_hw_stop(hdev);
 
-    // Free custom data and clear the driver data
+    // No more reports can arrive now, release the battery and free custom data
     if (vxe_dev) {
+        vxe_battery_put(vxe_dev);
+        kfree(vxe_dev->requests);
         kfree(vxe_dev);
         hid_set_drvdata(hdev, NULL);
     }
 }
 
 static const struct hid_device_id vxe_devices[] = {
-    { HID_USB_DEVICE(0x3554, 0xf58a) }, // wireless dongle
-    { HID_USB_DEVICE(0x3554, 0xf58c) }, // wired
+    { HID_USB_DEVICE(0x3554, 0xf58a), .driver_data = VXE_TRANSPORT_WIRELESS }, // wireless dongle
+    { HID_USB_DEVICE(0x3554, 0xf58c), .driver_data = VXE_TRANSPORT_WIRED },    // wired
     { }
 };
 MODULE_DEVICE_TABLE(hid, vxe_devices);
@@ -335,8 +1423,35 @@ static struct hid_driver vxe_driver = {
     .probe = vxe_probe,
     .raw_event = vxe_raw_event,
     .remove = vxe_remove,
+#ifdef CONFIG_PM
+    .suspend = vxe_suspend,
+    .resume = vxe_resume,
+    .reset_resume = vxe_reset_resume,
+#endif
 };
-module_hid_driver(vxe_driver);
+
+static int __init vxe_init(void) {
+    int ret;
+
+    vxe_wq = alloc_workqueue("hid-vxe-r1", WQ_POWER_EFFICIENT | WQ_FREEZABLE, 1);
+    if (!vxe_wq)
+        return -ENOMEM;
+
+    ret = hid_register_driver(&vxe_driver);
+    if (ret)
+        destroy_workqueue(vxe_wq);
+    return ret;
+}
+
+static void __exit vxe_exit(void) {
+    hid_unregister_driver(&vxe_driver);
+    // Every battery is gone, the tick may still be queued but finds nothing to poll
+    cancel_delayed_work_sync(&vxe_tick_work);
+    destroy_workqueue(vxe_wq);
+}
+
+module_init(vxe_init);
+module_exit(vxe_exit);
 
 MODULE_AUTHOR("Dominykas Svetikas <dominykas@svetikas.lt>");
 MODULE_DESCRIPTION("HID driver for obtaining VXE Dragonfly R1 Pro Max mouse battery status.");
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ *  Internal state of the hid-vxe-r1 driver.
+ *
+ *  Only the driver itself and its KUnit tests (vxe-protocol-test.c) include
+ *  this. Functions declared at the bottom are static unless the kernel is
+ *  built with CONFIG_KUNIT.
+ *
+ *  Copyright (c) 2025 Dominykas Svetikas <dominykas@svetikas.lt>
+ */
+
+#ifndef _HID_VXE_R1_H
+#define _HID_VXE_R1_H
+
+#include <linux/hid.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/power_supply.h>
+#include <linux/seqlock.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/average.h>
+
+#include "vxe-protocol.h"
+#include "vxe-history.h"
+
+// Number of power of two buckets in the request to response latency
+// histogram, the first one is up to 1 us and the last one is open ended
+#define LATENCY_BUCKETS 24
+// Charge and discharge rates are smoothed over roughly the last this many capacity steps
+#define RATE_EWMA_WEIGHT 4
+
+// A single battery reading. It is always published and read as a whole,
+// so the fields in it belong to the same response.
+struct vxe_battery_sample {
+    int capacity;      // Battery level in percent, -1 if unknown
+    int status;        // POWER_SUPPLY_STATUS_* value
+    int voltage;       // Battery voltage in mV
+    int time_to_empty; // Estimated seconds until empty while discharging, -1 if unknown
+    int time_to_full;  // Estimated seconds until full while charging, -1 if unknown
+    ktime_t timestamp; // When the response was received, 0 if never
+};
+
+// Fixed point moving average of the charge and discharge rates
+DECLARE_EWMA(vxe_rate, 8, RATE_EWMA_WEIGHT)
+
+// Vendor commands sent every poll cycle, see vxe_commands
+enum vxe_command_index {
+    VXE_COMMAND_BATTERY,
+    VXE_COMMAND_COUNT,
+};
+
+// Ways a mouse can be connected, in order of preference for polling
+enum vxe_transport {
+    VXE_TRANSPORT_WIRED,
+    VXE_TRANSPORT_WIRELESS,
+    VXE_TRANSPORT_COUNT,
+};
+
+struct vxe_mouse;
+
+/*
+ * Battery of one physical mouse. A mouse that is plugged in by cable while
+ * also being paired to its dongle shows up as two HID devices, both of them
+ * share a single battery and only one of them is polled.
+ */
+struct vxe_battery {
+    struct list_head list; // Entry in vxe_batteries
+    char uniq[64];         // Identity of the mouse, see vxe_battery_attach
+
+    // The fields below are protected by vxe_batteries_lock
+    unsigned int users;                                  // Attached HID devices
+    struct vxe_mouse *transports[VXE_TRANSPORT_COUNT];   // Live transports
+    struct vxe_mouse *active;                            // Transport that is polled
+    struct vxe_mouse *psy_parent;                        // Transport the power supply is registered on
+
+    // Scheduling state, see vxe_poll_tick
+    unsigned long next_poll;  // When the next poll is due, in jiffies
+    unsigned long poll_slack; // How much earlier the poll may go out to share a tick with others
+    bool poll_scheduled;      // next_poll is valid, false while polling is stopped
+    bool phased;              // The first regular poll has been placed at a random point of the interval
+    bool poll_missed; // A poll was skipped because the active transport was suspended
+    bool poll_now;    // Set by vxe_battery_poll_soon without holding the lock
+
+    // Outstanding regular poll, see vxe_battery_check_request
+    bool request_pending;
+    unsigned int request_attempt;   // Retries sent so far
+    unsigned long request_deadline; // When the current attempt counts as lost, in jiffies
+    u32 request_seq;                // history_seq when the poll was sent
+    bool stale; // The reading is older than stale_ms, cleared by the report handler
+
+    // Adaptive polling state, only touched from the scheduler
+    unsigned int poll_interval_ms; // Interval the next poll was scheduled with
+    unsigned int retry_ms;         // Retry delay while there is no reading yet
+    int polled_capacity;           // Capacity seen by the previous poll
+    int polled_status;             // Status seen by the previous poll
+    unsigned long wakeups_saved;   // Polls skipped compared to polling at poll_min_ms
+
+    // Notifies userspace about battery changes from process context, and
+    // registers the power supply once there is something to report
+    struct delayed_work battery_changed_work;
+
+    char psy_name[32];
+
+    // Fields for power supply management
+    struct power_supply_desc psy_desc;
+    struct power_supply *power_supply;
+    // Last known battery state. Writers hold battery_lock, which serializes
+    // the report handlers of both transports during a failover, readers go
+    // through vxe_battery_read to get a consistent copy.
+    seqlock_t battery_lock;
+    struct vxe_battery_sample battery;
+    // Ring of the last samples, written together with the battery field
+    u32 history_seq; // Samples written so far
+    struct vxe_history_record history[VXE_HISTORY_SIZE];
+    int notified_voltage; // Voltage userspace was last notified about
+
+    // Lazy mode, see vxe_battery_refresh
+    unsigned long refresh_jiffies; // When the outstanding refresh was requested, 0 if none
+    wait_queue_head_t sample_wait; // Readers waiting for the refresh
+    bool registering; // The power supply is being registered, see vxe_battery_register
+
+    // Runtime estimation, protected by battery_lock
+    struct vxe_battery_sample anchor; // Sample at the last capacity step or status change
+    bool anchor_is_step;              // The anchor was taken right at a capacity step
+    struct ewma_vxe_rate discharge_rate; // Milli-percent per hour
+    struct ewma_vxe_rate charge_rate;    // Milli-percent per hour
+    struct ewma_vxe_rate uv_per_pct;     // Voltage drop per percent while discharging, in uV
+};
+
+/*
+ * Request/response statistics of one transport. Request side counters are
+ * only written by the poll tick and response side counters only by the
+ * report handler, so none of them need a lock.
+ */
+struct vxe_stats {
+    // When the outstanding request of each command was sent, 0 if none
+    atomic64_t request_sent_ns[VXE_COMMAND_COUNT];
+
+    // Request side
+    unsigned long requests;    // Requests handed to the transport
+    unsigned long lost;        // Requests that never got a response
+    int last_error;            // Last error seen on this transport, 0 if none
+    unsigned long suspends;    // System and runtime suspends of this transport
+    unsigned long resumes;
+    unsigned long polls_skipped;      // Polls not sent because the transport was suspended
+    unsigned long retries;     // Polls resent because they weren't answered in time
+    unsigned long timeouts;    // Polls given up on after all retries
+    unsigned long suspended_requests; // Requests sent while suspended, must stay 0
+
+    // Response side
+    unsigned long responses;   // Responses matched to a request
+    unsigned long duplicates;  // Responses without an outstanding request
+    unsigned long malformed;   // Vendor reports that could not be handled
+    ktime_t attached;              // When the transport was probed
+    unsigned long first_sample_us; // Time from probe to the first valid reading, 0 until then
+    unsigned long latency_hist[LATENCY_BUCKETS];
+};
+
+// Structure to hold device-specific data
+struct vxe_mouse {
+    struct hid_device *hdev;
+    enum vxe_transport transport;
+    struct vxe_battery *battery;
+    bool suspended; // Written under vxe_batteries_lock
+    struct list_head send_node; // On vxe_send_queue while the tick is about to send to it
+
+    struct vxe_stats stats;
+    struct dentry *debugfs;
+
+    u8 *requests; // VXE_COMMAND_COUNT reports of VXE_REPORT_SIZE bytes, see vxe_prepare_requests
+};
+
+#if IS_ENABLED(CONFIG_KUNIT)
+void vxe_battery_publish(struct vxe_battery *battery, const struct vxe_battery_sample *sample);
+void vxe_battery_read(struct vxe_battery *battery, struct vxe_battery_sample *sample);
+bool vxe_battery_sample_changed(const struct vxe_battery_sample *old, const struct vxe_battery_sample *new,
+                                int notified_voltage, unsigned int hysteresis_mv);
+struct vxe_battery *vxe_battery_create(struct vxe_mouse *vxe_dev);
+void vxe_battery_free(struct vxe_battery *battery);
+int vxe_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size);
+#endif
+
+#endif /* _HID_VXE_R1_H */
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ *  Layout of the battery history file, see the README.
+ *
+ *  The driver keeps the last VXE_HISTORY_SIZE battery samples in a ring and
+ *  exposes it as the binary "history" attribute of the power supply. The file
+ *  is a header followed by the ring and fits in a single page, so one read
+ *  returns a consistent snapshot of all of it.
+ *
+ *  Copyright (c) 2025 Dominykas Svetikas <dominykas@svetikas.lt>
+ */
+
+#ifndef _VXE_HISTORY_H
+#define _VXE_HISTORY_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define VXE_HISTORY_MAGIC   0x48455856 // "VXEH" in little endian
+#define VXE_HISTORY_VERSION 1
+// Number of samples in the ring, picked so the whole file is 4096 bytes
+#define VXE_HISTORY_SIZE    255
+
+struct vxe_history_header {
+    uint32_t magic;       // VXE_HISTORY_MAGIC
+    uint16_t version;     // VXE_HISTORY_VERSION
+    uint16_t record_size; // sizeof(struct vxe_history_record)
+    uint32_t capacity;    // Number of records in the ring
+    uint32_t sequence;    // Samples written so far, the next one goes to record sequence % capacity
+};
+
+// A single battery sample, in native byte order
+struct vxe_history_record {
+    int64_t timestamp_ns; // CLOCK_BOOTTIME when the response arrived
+    uint32_t sequence;    // Number of the sample, only records below the header's sequence are valid
+    uint16_t voltage_mv;
+    int8_t capacity;      // Percent, -1 if unknown
+    uint8_t status;       // POWER_SUPPLY_STATUS_* value
+};
+
+#endif /* _VXE_HISTORY_H */
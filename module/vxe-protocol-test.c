@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  KUnit tests for the VXE vendor protocol, the report dispatch and the
+ *  battery snapshot of the hid-vxe-r1 driver.
+ *
+ *  Needs a kernel built with CONFIG_KUNIT, the module is only built then:
+ *    insmod hid-vxe-r1.ko && insmod vxe-protocol-test.ko
+ *    cat /sys/kernel/debug/kunit/vxe-protocol/results
+ *
+ *  Copyright (c) 2025 Dominykas Svetikas <dominykas@svetikas.lt>
+ */
+
+#include <kunit/test.h>
+#include <linux/delay.h>
+#include <linux/hid.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/power_supply.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/atomic.h>
+
+#include "vxe-protocol.h"
+#include "hid-vxe-r1.h"
+
+// Reports pushed through the dispatch per stream in vxe_test_dispatch_benchmark
+#define VXE_BENCH_REPORTS 2000000
+// How long vxe_test_publish_stress keeps the writer and the readers going
+#define VXE_STRESS_MS 2000
+
+// Battery query as sent by the driver and the configuration software
+static const u8 vxe_battery_request[VXE_REPORT_SIZE] = {
+    0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x49,
+};
+
+// Response of a discharging mouse at 65%, 3971 mV
+static const u8 vxe_battery_response[VXE_REPORT_SIZE] = {
+    0x08, 0x04, 0x00, 0x00, 0x00, 0x02, 0x41, 0x00, 0x0f, 0x83, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x74,
+};
+
+static void vxe_test_report_command(struct kunit *test) {
+    u8 report[VXE_REPORT_SIZE + 1];
+
+    memcpy(report, vxe_battery_response, VXE_REPORT_SIZE);
+    KUNIT_EXPECT_EQ(test, vxe_report_command(report, VXE_REPORT_SIZE), VXE_CMD_BATTERY);
+
+    // Truncated and oversized reports
+    KUNIT_EXPECT_EQ(test, vxe_report_command(report, VXE_REPORT_SIZE - 1), -EMSGSIZE);
+    KUNIT_EXPECT_EQ(test, vxe_report_command(report, 2), -EMSGSIZE);
+    KUNIT_EXPECT_EQ(test, vxe_report_command(report, VXE_REPORT_SIZE + 1), -EMSGSIZE);
+
+    // Not a vendor report at all
+    KUNIT_EXPECT_EQ(test, vxe_report_command(report, 0), -EPROTO);
+    report[0] = 0x03;
+    KUNIT_EXPECT_EQ(test, vxe_report_command(report, VXE_REPORT_SIZE), -EPROTO);
+
+    // Unknown commands are passed on, the caller decides what to do with them
+    report[0] = VXE_REPORT_ID;
+    report[VXE_OFF_COMMAND] = 0x7f;
+    KUNIT_EXPECT_EQ(test, vxe_report_command(report, VXE_REPORT_SIZE), 0x7f);
+}
+
+static void vxe_test_parse_battery(struct kunit *test) {
+    struct vxe_battery_info info;
+    u8 report[VXE_REPORT_SIZE + 1];
+
+    memcpy(report, vxe_battery_response, VXE_REPORT_SIZE);
+    KUNIT_ASSERT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), 0);
+    KUNIT_EXPECT_EQ(test, info.level, 65);
+    KUNIT_EXPECT_EQ(test, info.charge, VXE_CHARGE_DISCHARGING);
+    KUNIT_EXPECT_EQ(test, info.voltage_mv, 3971);
+    KUNIT_EXPECT_FALSE(test, vxe_battery_charging(&info));
+
+    report[VXE_OFF_BATTERY_CHARGE] = VXE_CHARGE_CHARGING;
+    KUNIT_ASSERT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), 0);
+    KUNIT_EXPECT_TRUE(test, vxe_battery_charging(&info));
+
+    // Unknown charge states count as discharging
+    report[VXE_OFF_BATTERY_CHARGE] = 0x07;
+    KUNIT_ASSERT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), 0);
+    KUNIT_EXPECT_FALSE(test, vxe_battery_charging(&info));
+
+    KUNIT_EXPECT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE - 1, &info), -EMSGSIZE);
+    KUNIT_EXPECT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE + 1, &info), -EMSGSIZE);
+
+    report[VXE_OFF_BATTERY_LEVEL] = 100;
+    KUNIT_EXPECT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), 0);
+    report[VXE_OFF_BATTERY_LEVEL] = 101;
+    KUNIT_EXPECT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), -ERANGE);
+    report[VXE_OFF_BATTERY_LEVEL] = 0xff;
+    KUNIT_EXPECT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), -ERANGE);
+
+    report[VXE_OFF_BATTERY_LEVEL] = 50;
+    report[VXE_OFF_COMMAND] = 0x05;
+    KUNIT_EXPECT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), -EPROTO);
+
+    report[VXE_OFF_COMMAND] = VXE_CMD_BATTERY;
+    report[0] = 0x02;
+    KUNIT_EXPECT_EQ(test, vxe_parse_battery(report, VXE_REPORT_SIZE, &info), -EPROTO);
+}
+
+static void vxe_test_checksum(struct kunit *test) {
+    u8 report[VXE_REPORT_SIZE];
+    u8 sum = 0;
+
+    KUNIT_EXPECT_EQ(test, vxe_checksum(vxe_battery_request), 0x49);
+    KUNIT_EXPECT_EQ(test, vxe_checksum(vxe_battery_response), 0x74);
+
+    vxe_build_command(report, VXE_CMD_BATTERY);
+    KUNIT_EXPECT_MEMEQ(test, report, vxe_battery_request, VXE_REPORT_SIZE);
+
+    // Every report built adds up to the checksum total
+    for (int command = 0; command <= 0xff; command++) {
+        vxe_build_command(report, command);
+        sum = 0;
+        for (int i = 0; i < VXE_REPORT_SIZE; i++)
+            sum += report[i];
+        KUNIT_EXPECT_EQ(test, sum, VXE_CHECKSUM_TOTAL);
+    }
+}
+
+static void vxe_test_sample_changed(struct kunit *test) {
+    struct vxe_battery_sample old = {
+        .capacity = 65,
+        .status = POWER_SUPPLY_STATUS_DISCHARGING,
+        .voltage = 3971,
+    };
+    struct vxe_battery_sample new = old;
+
+    KUNIT_EXPECT_FALSE(test, vxe_battery_sample_changed(&old, &new, 3971, 20));
+
+    // Voltage is compared against the last notification, not the last sample
+    new.voltage = 3952;
+    KUNIT_EXPECT_FALSE(test, vxe_battery_sample_changed(&old, &new, 3971, 20));
+    new.voltage = 3951;
+    KUNIT_EXPECT_TRUE(test, vxe_battery_sample_changed(&old, &new, 3971, 20));
+    new.voltage = 3991;
+    KUNIT_EXPECT_TRUE(test, vxe_battery_sample_changed(&old, &new, 3971, 20));
+    new.voltage = 3960;
+    KUNIT_EXPECT_FALSE(test, vxe_battery_sample_changed(&new, &new, 3971, 20));
+    KUNIT_EXPECT_TRUE(test, vxe_battery_sample_changed(&new, &new, 3980, 20));
+
+    // No hysteresis reports every sample
+    KUNIT_EXPECT_TRUE(test, vxe_battery_sample_changed(&old, &old, 3971, 0));
+
+    // Level and status changes are reported regardless of the voltage
+    new = old;
+    new.capacity = 64;
+    KUNIT_EXPECT_TRUE(test, vxe_battery_sample_changed(&old, &new, 3971, 20));
+    new = old;
+    new.status = POWER_SUPPLY_STATUS_CHARGING;
+    KUNIT_EXPECT_TRUE(test, vxe_battery_sample_changed(&old, &new, 3971, 20));
+}
+
+// A battery interface with driver data, as vxe_probe leaves it, but no active transport
+struct vxe_test_device {
+    struct hid_device *hdev;
+    struct vxe_mouse *vxe_dev;
+};
+
+static void vxe_test_device_exit(void *data) {
+    struct vxe_test_device *dev = data;
+
+    vxe_battery_free(dev->vxe_dev->battery);
+}
+
+static struct vxe_test_device *vxe_test_device_create(struct kunit *test) {
+    struct vxe_test_device *dev = kunit_kzalloc(test, sizeof(*dev), GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_NULL(test, dev);
+    dev->hdev = kunit_kzalloc(test, sizeof(*dev->hdev), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, dev->hdev);
+    dev->vxe_dev = kunit_kzalloc(test, sizeof(*dev->vxe_dev), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, dev->vxe_dev);
+
+    dev->vxe_dev->hdev = dev->hdev;
+    dev->vxe_dev->transport = VXE_TRANSPORT_WIRELESS;
+    // Keeps the first response from being logged
+    dev->vxe_dev->stats.first_sample_us = 1;
+    dev->vxe_dev->battery = vxe_battery_create(dev->vxe_dev);
+    KUNIT_ASSERT_NOT_NULL(test, dev->vxe_dev->battery);
+    KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, vxe_test_device_exit, dev), 0);
+
+    hid_set_drvdata(dev->hdev, dev->vxe_dev);
+    return dev;
+}
+
+/*
+ * Pushes reports through vxe_raw_event and the vxe_report_handlers table:
+ * pointer motion on an interface without driver data, consumer control on
+ * the battery interface and battery responses. The battery has no active
+ * transport, so responses are decoded and counted but not published.
+ */
+static void vxe_test_dispatch_benchmark(struct kunit *test) {
+    struct vxe_test_device *dev = vxe_test_device_create(test);
+    struct hid_device *motion_hdev = kunit_kzalloc(test, sizeof(*motion_hdev), GFP_KERNEL);
+    struct vxe_stats *stats = &dev->vxe_dev->stats;
+    u8 motion[] = { 0x01, 0x00, 0x05, 0x00, 0xfd, 0xff, 0x00 };
+    u8 consumer[] = { 0x03, 0xe9, 0x00 };
+    u8 response[VXE_REPORT_SIZE];
+    struct {
+        const char *name;
+        struct hid_device *hdev;
+        struct hid_report report;
+        u8 *data;
+        int size;
+    } streams[] = {
+        { "motion", motion_hdev, { .id = 0 }, motion, sizeof(motion) },
+        { "consumer", dev->hdev, { .id = 3 }, consumer, sizeof(consumer) },
+        { "battery", dev->hdev, { .id = VXE_REPORT_ID }, response, sizeof(response) },
+    };
+
+    KUNIT_ASSERT_NOT_NULL(test, motion_hdev);
+    memcpy(response, vxe_battery_response, sizeof(response));
+
+    for (int i = 0; i < ARRAY_SIZE(streams); i++) {
+        u64 start = ktime_get_ns();
+
+        for (int n = 0; n < VXE_BENCH_REPORTS; n++) {
+            vxe_raw_event(streams[i].hdev, &streams[i].report, streams[i].data, streams[i].size);
+            if (!(n & 0xffff))
+                cond_resched();
+        }
+
+        kunit_info(test, "%s: %llu ps per report\n", streams[i].name,
+                   div_u64((ktime_get_ns() - start) * 1000, VXE_BENCH_REPORTS));
+    }
+
+    // Only the battery responses reached a handler, none of them answered a request
+    KUNIT_EXPECT_EQ(test, stats->duplicates, VXE_BENCH_REPORTS);
+    KUNIT_EXPECT_EQ(test, stats->responses, 0);
+    KUNIT_EXPECT_EQ(test, stats->malformed, 0);
+}
+
+// Vendor reports that can't be handled are counted, everything else is left alone
+static void vxe_test_dispatch_malformed(struct kunit *test) {
+    struct vxe_test_device *dev = vxe_test_device_create(test);
+    struct vxe_stats *stats = &dev->vxe_dev->stats;
+    struct hid_report vendor = { .id = VXE_REPORT_ID }, consumer = { .id = 3 };
+    u8 report[VXE_REPORT_SIZE];
+
+    memcpy(report, vxe_battery_response, sizeof(report));
+    KUNIT_EXPECT_EQ(test, vxe_raw_event(dev->hdev, &vendor, report, VXE_REPORT_SIZE - 1), 0);
+    report[VXE_OFF_BATTERY_LEVEL] = 101;
+    KUNIT_EXPECT_EQ(test, vxe_raw_event(dev->hdev, &vendor, report, VXE_REPORT_SIZE), 0);
+    report[VXE_OFF_COMMAND] = 0x7f;
+    KUNIT_EXPECT_EQ(test, vxe_raw_event(dev->hdev, &vendor, report, VXE_REPORT_SIZE), 0);
+    KUNIT_EXPECT_EQ(test, stats->malformed, 3);
+
+    KUNIT_EXPECT_EQ(test, vxe_raw_event(dev->hdev, &consumer, report, 3), 0);
+    KUNIT_EXPECT_EQ(test, stats->malformed, 3);
+    KUNIT_EXPECT_EQ(test, stats->duplicates, 0);
+}
+
+// Sample number n of vxe_test_publish_stress, every field is derived from n
+static struct vxe_battery_sample vxe_test_stress_sample(u32 n) {
+    return (struct vxe_battery_sample) {
+        .capacity = n % 101,
+        .status = n & 1 ? POWER_SUPPLY_STATUS_CHARGING : POWER_SUPPLY_STATUS_DISCHARGING,
+        .voltage = n,
+        .time_to_empty = n ^ 0x5a5a5a5a,
+        .time_to_full = ~n,
+        .timestamp = ns_to_ktime(n),
+    };
+}
+
+static bool vxe_test_sample_equal(const struct vxe_battery_sample *a, const struct vxe_battery_sample *b) {
+    return a->capacity == b->capacity && a->status == b->status && a->voltage == b->voltage &&
+           a->time_to_empty == b->time_to_empty && a->time_to_full == b->time_to_full &&
+           ktime_compare(a->timestamp, b->timestamp) == 0;
+}
+
+struct vxe_test_stress {
+    struct vxe_battery *battery;
+    atomic_long_t reads;
+    atomic_long_t torn;    // Copies whose fields came from different samples
+    atomic_long_t stale;   // Copies older than one the same reader saw before
+    unsigned long writes;
+};
+
+static int vxe_test_stress_writer(void *data) {
+    struct vxe_test_stress *stress = data;
+    u32 n = 1;
+
+    while (!kthread_should_stop()) {
+        struct vxe_battery_sample sample = vxe_test_stress_sample(n++);
+
+        vxe_battery_publish(stress->battery, &sample);
+        if (!(n & 0x3ff))
+            cond_resched();
+    }
+    stress->writes = n - 1;
+    return 0;
+}
+
+static int vxe_test_stress_reader(void *data) {
+    struct vxe_test_stress *stress = data;
+    long reads = 0, torn = 0, stale = 0;
+    u32 last = 0;
+
+    while (!kthread_should_stop()) {
+        struct vxe_battery_sample copy, expected;
+        u32 n;
+
+        vxe_battery_read(stress->battery, &copy);
+        n = ktime_to_ns(copy.timestamp);
+        expected = vxe_test_stress_sample(n);
+        if (!vxe_test_sample_equal(&copy, &expected))
+            torn++;
+        else if (n < last)
+            stale++;
+        last = max(last, n);
+        if (!(++reads & 0x3ff))
+            cond_resched();
+    }
+
+    atomic_long_add(reads, &stress->reads);
+    atomic_long_add(torn, &stress->torn);
+    atomic_long_add(stale, &stress->stale);
+    return 0;
+}
+
+/*
+ * Publishes samples from one kthread while a reader per CPU takes copies,
+ * and checks that the fields of every copy belong to the same sample and
+ * that no reader ever goes back to an older one.
+ */
+static void vxe_test_publish_stress(struct kunit *test) {
+    struct vxe_test_device *dev = vxe_test_device_create(test);
+    struct vxe_battery_sample first = vxe_test_stress_sample(0);
+    struct vxe_test_stress stress = { .battery = dev->vxe_dev->battery };
+    int readers = clamp_t(int, num_online_cpus(), 2, 16);
+    struct task_struct *writer, *threads[16];
+    int started = 0;
+
+    // The initial unknown sample doesn't follow the pattern
+    vxe_battery_publish(stress.battery, &first);
+
+    for (; started < readers; started++) {
+        threads[started] = kthread_run(vxe_test_stress_reader, &stress, "vxe-test-read/%d", started);
+        if (IS_ERR(threads[started]))
+            break;
+    }
+    writer = kthread_run(vxe_test_stress_writer, &stress, "vxe-test-write");
+    if (!IS_ERR(writer)) {
+        msleep(VXE_STRESS_MS);
+        kthread_stop(writer);
+    }
+    for (int i = 0; i < started; i++)
+        kthread_stop(threads[i]);
+
+    KUNIT_ASSERT_FALSE(test, IS_ERR(writer));
+    KUNIT_ASSERT_EQ(test, started, readers);
+    kunit_info(test, "%lu writes, %ld reads by %d readers\n", stress.writes,
+               atomic_long_read(&stress.reads), readers);
+    KUNIT_EXPECT_GT(test, stress.writes, 0);
+    KUNIT_EXPECT_GT(test, atomic_long_read(&stress.reads), 0);
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&stress.torn), 0);
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&stress.stale), 0);
+}
+
+static struct kunit_case vxe_protocol_test_cases[] = {
+    KUNIT_CASE(vxe_test_report_command),
+    KUNIT_CASE(vxe_test_parse_battery),
+    KUNIT_CASE(vxe_test_checksum),
+    KUNIT_CASE(vxe_test_sample_changed),
+    KUNIT_CASE(vxe_test_dispatch_malformed),
+    KUNIT_CASE_SLOW(vxe_test_dispatch_benchmark),
+    KUNIT_CASE_SLOW(vxe_test_publish_stress),
+    {}
+};
+
+static struct kunit_suite vxe_protocol_test_suite = {
+    .name = "vxe-protocol",
+    .test_cases = vxe_protocol_test_cases,
+};
+kunit_test_suite(vxe_protocol_test_suite);
+
+MODULE_IMPORT_NS("EXPORTED_FOR_KUNIT_TESTING");
+MODULE_AUTHOR("Dominykas Svetikas <dominykas@svetikas.lt>");
+MODULE_DESCRIPTION("KUnit tests for the VXE Dragonfly R1 Pro Max battery driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ *  VXE Dragonfly R1 Pro Max vendor protocol.
+ *
+ *  Everything in here is a pure function of its arguments and builds both as
+ *  part of the kernel module and in userspace, so the packet handling can be
+ *  exercised without the physical mouse.
+ *
+ *  Copyright (c) 2025 Dominykas Svetikas <dominykas@svetikas.lt>
+ */
+
+#ifndef _VXE_PROTOCOL_H
+#define _VXE_PROTOCOL_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/errno.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#endif
+
+// Vendor reports are sent and received on interface 1 with this report ID
+#define VXE_REPORT_ID 0x08
+// Size of a vendor report including the report ID
+#define VXE_REPORT_SIZE 17
+// Number of 8 bit values in the vendor output report, without the report ID
+#define VXE_REPORT_VALUES 16
+
+// Command IDs. The configuration software also reads the firmware version,
+// DPI and polling rate, but the IDs for those have not been captured yet.
+#define VXE_CMD_BATTERY 0x04
+
+// Byte offsets in a vendor report, including the report ID
+#define VXE_OFF_COMMAND         1
+#define VXE_OFF_BATTERY_LEVEL   6
+#define VXE_OFF_BATTERY_CHARGE  7
+#define VXE_OFF_BATTERY_VOLTAGE 8 // Big endian, 2 bytes
+#define VXE_OFF_CHECKSUM        16
+
+// All bytes of a vendor report, the checksum included, add up to this value
+#define VXE_CHECKSUM_TOTAL 0x55
+
+// Values of the charge state byte in a battery response
+#define VXE_CHARGE_DISCHARGING 0x00
+#define VXE_CHARGE_CHARGING    0x01
+
+// Decoded battery response
+struct vxe_battery_info {
+    uint8_t level;       // Battery level in percent
+    uint8_t charge;      // Raw charge state, see VXE_CHARGE_*
+    uint16_t voltage_mv; // Battery voltage in mV
+};
+
+/*
+ * Checks that an output report can carry a vendor command.
+ * report_count is the number of values in the first field of the report.
+ */
+static inline bool vxe_output_report_valid(unsigned int report_id, unsigned int report_count) {
+    return report_id == VXE_REPORT_ID && report_count >= VXE_REPORT_VALUES;
+}
+
+// Computes the checksum byte of a VXE_REPORT_SIZE byte vendor report
+static inline uint8_t vxe_checksum(const uint8_t *report) {
+    uint8_t sum = 0;
+
+    for (int i = 0; i < VXE_OFF_CHECKSUM; i++)
+        sum += report[i];
+    return (uint8_t)(VXE_CHECKSUM_TOTAL - sum);
+}
+
+/*
+ * Builds the VXE_REPORT_SIZE byte vendor report for a command without
+ * arguments, report ID included.
+ */
+static inline void vxe_build_command(uint8_t *report, uint8_t command) {
+    for (int i = 0; i < VXE_REPORT_SIZE; i++)
+        report[i] = 0;
+    report[0] = VXE_REPORT_ID;
+    report[VXE_OFF_COMMAND] = command;
+    report[VXE_OFF_CHECKSUM] = vxe_checksum(report);
+}
+
+/*
+ * Returns the command ID of a vendor report, -EPROTO if it is not a vendor
+ * report or -EMSGSIZE if it is truncated or oversized.
+ */
+static inline int vxe_report_command(const uint8_t *data, int size) {
+    if (size < 1 || data[0] != VXE_REPORT_ID)
+        return -EPROTO;
+    if (size != VXE_REPORT_SIZE)
+        return -EMSGSIZE;
+    return data[VXE_OFF_COMMAND];
+}
+
+/*
+ * Decodes a battery response. Returns 0 on success, -EPROTO if the report
+ * is not a battery response, -EMSGSIZE if it is truncated or oversized and
+ * -ERANGE if the values in it make no sense.
+ */
+static inline int vxe_parse_battery(const uint8_t *data, int size, struct vxe_battery_info *info) {
+    int command = vxe_report_command(data, size);
+
+    if (command < 0)
+        return command;
+    if (command != VXE_CMD_BATTERY)
+        return -EPROTO;
+    if (data[VXE_OFF_BATTERY_LEVEL] > 100)
+        return -ERANGE;
+
+    info->level = data[VXE_OFF_BATTERY_LEVEL];
+    info->charge = data[VXE_OFF_BATTERY_CHARGE];
+    info->voltage_mv = (data[VXE_OFF_BATTERY_VOLTAGE] << 8) | data[VXE_OFF_BATTERY_VOLTAGE + 1];
+    return 0;
+}
+
+// Anything but an explicit charging state is treated as discharging
+static inline bool vxe_battery_charging(const struct vxe_battery_info *info) {
+    return info->charge == VXE_CHARGE_CHARGING;
+}
+
+#endif /* _VXE_PROTOCOL_H */
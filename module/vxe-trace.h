@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ *  Tracepoints for the VXE Dragonfly R1 Pro Max battery query path.
+ *
+ *  Copyright (c) 2025 Dominykas Svetikas <dominykas@svetikas.lt>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vxe_r1
+
+#if !defined(_VXE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _VXE_TRACE_H
+
+#include <linux/hid.h>
+#include <linux/tracepoint.h>
+
+// A vendor command was handed to the HID transport
+TRACE_EVENT(vxe_request,
+    TP_PROTO(struct hid_device *hdev, u8 command, int ret),
+    TP_ARGS(hdev, command, ret),
+
+    TP_STRUCT__entry(
+        __string(dev, dev_name(&hdev->dev))
+        __field(u8, command)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->command = command;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("dev=%s command=0x%02x ret=%d", __get_str(dev), __entry->command, __entry->ret)
+);
+
+// A battery response was received, latency is -1 if no request was outstanding
+TRACE_EVENT(vxe_battery_response,
+    TP_PROTO(struct hid_device *hdev, int capacity, int charging, int voltage, s64 latency_us),
+    TP_ARGS(hdev, capacity, charging, voltage, latency_us),
+
+    TP_STRUCT__entry(
+        __string(dev, dev_name(&hdev->dev))
+        __field(int, capacity)
+        __field(int, charging)
+        __field(int, voltage)
+        __field(s64, latency_us)
+    ),
+
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->capacity = capacity;
+        __entry->charging = charging;
+        __entry->voltage = voltage;
+        __entry->latency_us = latency_us;
+    ),
+
+    TP_printk("dev=%s capacity=%d%% charging=%d voltage=%dmV latency=%lldus",
+              __get_str(dev), __entry->capacity, __entry->charging,
+              __entry->voltage, __entry->latency_us)
+);
+
+// A vendor report that could not be handled
+TRACE_EVENT(vxe_bad_report,
+    TP_PROTO(struct hid_device *hdev, const u8 *data, int size),
+    TP_ARGS(hdev, data, size),
+
+    TP_STRUCT__entry(
+        __string(dev, dev_name(&hdev->dev))
+        __field(int, size)
+        __array(u8, data, 17)
+    ),
+
+    TP_fast_assign(
+        __assign_str(dev);
+        __entry->size = size;
+        memset(__entry->data, 0, sizeof(__entry->data));
+        memcpy(__entry->data, data, min_t(int, size, sizeof(__entry->data)));
+    ),
+
+    TP_printk("dev=%s size=%d data=%*phN", __get_str(dev), __entry->size,
+              min_t(int, __entry->size, 17), __entry->data)
+);
+
+#endif /* _VXE_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE vxe-trace
+#include <trace/define_trace.h>
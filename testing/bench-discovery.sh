@@ -0,0 +1,68 @@
+#!/bin/sh
+# Benchmarks hidraw device discovery against a fake sysfs tree with many HID devices.
+#
+# Usage: ./bench-discovery.sh [devices] [runs]
+#
+# Builds ./hidraw if needed, creates a fake /sys/class/hidraw with the given
+# number of unrelated devices plus the three interfaces of the mouse (the vendor
+# interface last, the worst case for a linear scan) and times discovery with an
+# empty and with a warm cache.
+set -eu
+
+devices=${1:-1000}
+runs=${2:-100}
+here=$(cd "$(dirname "$0")" && pwd)
+
+[ -x "$here/hidraw" ] || gcc -O2 -Wall "$here/hidraw.c" -o "$here/hidraw"
+
+root=$(mktemp -d)
+trap 'rm -rf "$root"' EXIT
+
+# Converts the descriptors from investigation/ into their binary form
+for int in int0 int1 int2; do
+    for byte in $(sed 's#//.*##' "$here/../investigation/$int" | grep -o '0x[0-9A-Fa-f][0-9A-Fa-f]'); do
+        printf "\\$(printf '%03o' "$byte")"
+    done > "$root/$int"
+done
+
+# add_node <index> <vendor> <product> <interface> <descriptor>
+add_node() {
+    intf="$root/devices/usb$1/1-1:1.$4"
+    hid="$intf/0003:$2:$3.$1"
+    mkdir -p "$hid" "$root/class/hidraw/hidraw$1"
+    printf '%02x\n' "$4" > "$intf/bInterfaceNumber"
+    printf 'DRIVER=hid-generic\nHID_ID=0003:0000%s:0000%s\nHID_NAME=Fake\n' "$2" "$3" > "$hid/uevent"
+    cp "$root/$5" "$hid/report_descriptor"
+    ln -s "../../../devices/usb$1/1-1:1.$4/0003:$2:$3.$1" "$root/class/hidraw/hidraw$1/device"
+}
+
+i=0
+while [ "$i" -lt "$devices" ]; do
+    add_node "$i" 046D "$(printf '%04X' $((i % 0x10000)))" 0 int0
+    i=$((i + 1))
+done
+add_node "$i" 3554 F58A 0 int0
+add_node "$((i + 1))" 3554 F58A 2 int2
+add_node "$((i + 2))" 3554 F58A 1 int1
+
+export VXE_HIDRAW_SYSFS="$root/class/hidraw"
+export VXE_HIDRAW_DEV="$root/dev"
+export VXE_HIDRAW_CACHE="$root/cache"
+
+# bench <label> <clear cache>
+bench() {
+    start=$(date +%s%N)
+    n=0
+    while [ "$n" -lt "$runs" ]; do
+        [ "$2" = 1 ] && rm -f "$VXE_HIDRAW_CACHE"
+        "$here/hidraw" --find > /dev/null
+        n=$((n + 1))
+    done
+    end=$(date +%s%N)
+    echo "$1: $(((end - start) / runs / 1000)) us per discovery"
+}
+
+echo "$devices unrelated hidraw devices, $runs runs"
+"$here/hidraw" --find | tail -n 1
+bench "cold (sysfs scan)" 1
+bench "warm (cached)    " 0
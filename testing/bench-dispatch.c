@@ -0,0 +1,306 @@
+// Measures the per-report cost of the raw_event dispatch of the driver.
+//
+// Build: gcc -O2 -Wall bench-dispatch.c -o bench-dispatch -lm
+//
+// Usage: ./bench-dispatch [-c] [-n reports]
+//
+// Runs the dispatch from before and after the handler table through the same
+// streams of reports: pointer motion on interface 0 (report ID 0, the 1 kHz
+// hot path), consumer and system control reports on the battery interface
+// (IDs 2 and 3) and battery responses (ID 8). The kernel structures are
+// replaced by mock ones with the same pointer chains, and raw_event is called
+// through a function pointer like HID core does. The hid_info calls the old
+// dispatch made for every battery response are left out.
+//
+// In a tight loop everything stays in L1, while at 1 kHz the structures are
+// usually cold. With -c (x86 only) the cache lines of the driver and the
+// device structures are flushed before every report and each call is timed on
+// its own, minus the cost of timing an empty raw_event. The report and its
+// data stay cached, HID core has just parsed them.
+//
+// Every cost is printed with its standard error: over 10 batches in a tight
+// loop, over the single calls with -c. A cost that is within its error of the
+// timing overhead is printed as 0.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../module/vxe-protocol.h"
+
+#define TARGET_INTERFACE 1
+#define HID_MAX_IDS      256
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+// Just the parts of the kernel structures the dispatch touches
+struct device {
+    struct device *parent;
+    void *driver_data;
+};
+
+struct usb_interface_descriptor {
+    uint8_t bInterfaceNumber;
+};
+
+struct usb_host_interface {
+    struct usb_interface_descriptor desc;
+};
+
+struct usb_interface {
+    struct usb_host_interface *cur_altsetting;
+    struct device dev;
+};
+
+struct hid_device {
+    struct device dev;
+};
+
+struct hid_report {
+    unsigned int id;
+};
+
+struct vxe_mouse {
+    int capacity;
+    int status;
+    int voltage;
+    unsigned long malformed;
+    int interface; // Stands in for the interface number the old dispatch logged
+};
+
+typedef int (*raw_event_fn)(struct hid_device *hdev, struct hid_report *report, uint8_t *data, int size);
+typedef void (*vxe_report_handler)(struct vxe_mouse *vxe_dev, uint8_t *data, int size);
+
+static struct usb_interface *to_usb_interface(struct device *dev) {
+    return container_of(dev, struct usb_interface, dev);
+}
+
+// Before: the interface number is looked up for every report
+__attribute__((noinline))
+static int raw_event_before(struct hid_device *hdev, struct hid_report *report, uint8_t *data, int size) {
+    struct usb_interface *intf = to_usb_interface(hdev->dev.parent);
+    int ifnum = intf->cur_altsetting->desc.bInterfaceNumber;
+
+    // ifnum is only used for battery responses here, without this the
+    // compiler would sink the lookup into that branch. The old driver looked
+    // it up before checking the report, for every report.
+    __asm__ volatile("" : : "r"(ifnum));
+
+    (void)report;
+    if (size == 17 && data[0] == 0x08 && data[1] == 0x04) {
+        struct vxe_mouse *vxe_dev = hdev->dev.driver_data;
+
+        vxe_dev->interface = ifnum;
+        vxe_dev->capacity = data[6];
+        vxe_dev->status = data[7] == 0x01;
+        vxe_dev->voltage = (data[8] << 8) | data[9];
+    }
+    return 0;
+}
+
+// After: reports without a handler are dropped by ID without touching memory, driver data
+// only exists on the battery interface and handlers are looked up by report ID
+static void vendor_report(struct vxe_mouse *vxe_dev, uint8_t *data, int size) {
+    struct vxe_battery_info info;
+
+    if (vxe_parse_battery(data, size, &info)) {
+        vxe_dev->malformed++;
+        return;
+    }
+    vxe_dev->capacity = info.level;
+    vxe_dev->status = vxe_battery_charging(&info);
+    vxe_dev->voltage = info.voltage_mv;
+}
+
+static const vxe_report_handler report_handlers[HID_MAX_IDS] = {
+    [VXE_REPORT_ID] = vendor_report,
+};
+#define HANDLED_REPORT_IDS (1ULL << VXE_REPORT_ID)
+
+__attribute__((noinline))
+static int raw_event_after(struct hid_device *hdev, struct hid_report *report, uint8_t *data, int size) {
+    struct vxe_mouse *vxe_dev;
+    vxe_report_handler handler;
+
+    if (__builtin_expect(report->id >= 64 || !(HANDLED_REPORT_IDS & (1ULL << report->id)), 1))
+        return 0;
+
+    vxe_dev = hdev->dev.driver_data;
+    if (!vxe_dev)
+        return 0;
+
+    handler = report_handlers[report->id];
+    if (handler)
+        handler(vxe_dev, data, size);
+    return 0;
+}
+
+__attribute__((noinline))
+static int raw_event_empty(struct hid_device *hdev, struct hid_report *report, uint8_t *data, int size) {
+    (void)hdev, (void)report, (void)data, (void)size;
+    return 0;
+}
+
+// One interface of the mouse with a report it keeps sending
+struct stream {
+    const char *name;
+    struct hid_device *hdev;
+    struct hid_report report;
+    uint8_t data[VXE_REPORT_SIZE];
+    int size;
+};
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Nanoseconds per report and the standard error of that mean
+struct cost {
+    double ns;
+    double err;
+};
+
+#define BATCHES 10
+
+// Adds a sample to a running mean and sum of squared deviations (Welford)
+static void sample_add(double x, long n, double *mean, double *m2) {
+    double delta = x - *mean;
+    *mean += delta / n;
+    *m2 += delta * (x - *mean);
+}
+
+static struct cost cost_of(long n, double mean, double m2) {
+    return (struct cost) { mean, n > 1 ? sqrt(m2 / (n - 1) / n) : 0 };
+}
+
+// Times BATCHES batches of reports in a tight loop
+static struct cost run(raw_event_fn *fn, struct stream *s, long reports) {
+    long batch = reports / BATCHES > 0 ? reports / BATCHES : 1;
+    double mean = 0, m2 = 0;
+
+    for (long b = 1; b <= BATCHES; b++) {
+        double start = now_s();
+        for (long i = 0; i < batch; i++)
+            (*fn)(s->hdev, &s->report, s->data, s->size);
+        sample_add((now_s() - start) / batch * 1e9, b, &mean, &m2);
+    }
+    return cost_of(BATCHES, mean, m2);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void flush(const void *p) {
+    _mm_clflush(p);
+}
+#else
+static void flush(const void *p) {
+    (void)p;
+}
+#endif
+
+// Every cache line either dispatch reads, filled in by main
+static const void *cold_lines[16];
+static int cold_line_count;
+
+// Times every report on its own with cold caches
+static struct cost run_cold(raw_event_fn *fn, struct stream *s, long reports) {
+    double mean = 0, m2 = 0;
+
+    for (long i = 1; i <= reports; i++) {
+        for (int j = 0; j < cold_line_count; j++)
+            flush(cold_lines[j]);
+        __sync_synchronize();
+
+        double start = now_s();
+        (*fn)(s->hdev, &s->report, s->data, s->size);
+        sample_add((now_s() - start) * 1e9, i, &mean, &m2);
+    }
+    return cost_of(reports, mean, m2);
+}
+
+// Subtracts the timing overhead. The errors add up, and a cost the overhead
+// hides within that error is 0 rather than negative.
+static struct cost minus_overhead(struct cost c, struct cost overhead) {
+    struct cost net = { c.ns - overhead.ns, sqrt(c.err * c.err + overhead.err * overhead.err) };
+    if (net.ns < net.err)
+        net.ns = 0;
+    return net;
+}
+
+int main(int argc, char **argv) {
+    long reports = 0;
+    bool cold = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cn:h")) != -1) {
+        switch (opt) {
+        case 'c': cold = true; break;
+        case 'n': reports = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-c] [-n reports]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (reports <= 0)
+        reports = cold ? 1000000 : 100000000;
+
+    // Separate allocations like the real structures, so they don't share cache lines
+    struct usb_host_interface *alt[2];
+    struct usb_interface *intf[2];
+    struct hid_device *hdev[2];
+    struct vxe_mouse *mouse = calloc(1, sizeof(*mouse));
+    for (int i = 0; i < 2; i++) {
+        alt[i] = calloc(1, sizeof(*alt[i]));
+        alt[i]->desc.bInterfaceNumber = i;
+        intf[i] = calloc(1, sizeof(*intf[i]));
+        intf[i]->cur_altsetting = alt[i];
+        hdev[i] = calloc(1, sizeof(*hdev[i]));
+        hdev[i]->dev.parent = &intf[i]->dev;
+        cold_lines[cold_line_count++] = alt[i];
+        cold_lines[cold_line_count++] = intf[i];
+        cold_lines[cold_line_count++] = hdev[i];
+    }
+    hdev[TARGET_INTERFACE]->dev.driver_data = mouse;
+    cold_lines[cold_line_count++] = mouse;
+    cold_lines[cold_line_count++] = &report_handlers[0];
+    cold_lines[cold_line_count++] = &report_handlers[VXE_REPORT_ID];
+
+    struct stream streams[] = {
+        { "motion (if 0, ID 0)", hdev[0], { 0 }, { 0x01, 0x00, 0x05, 0x00, 0xfd, 0xff, 0x00 }, 7 },
+        { "consumer (if 1, ID 3)", hdev[1], { 3 }, { 0x03, 0xe9, 0x00 }, 3 },
+        { "battery (if 1, ID 8)", hdev[1], { VXE_REPORT_ID },
+          { 0x08, 0x04, 0x00, 0x00, 0x00, 0x02, 0x41, 0x00, 0x0f, 0x83, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x74 },
+          VXE_REPORT_SIZE },
+    };
+
+    // Volatile so the call can't be inlined into the loop
+    raw_event_fn before = raw_event_before, after = raw_event_after, empty = raw_event_empty;
+    raw_event_fn *volatile fn_before = &before, *volatile fn_after = &after, *volatile fn_empty = &empty;
+    struct cost (*measure)(raw_event_fn *fn, struct stream *s, long reports) = cold ? run_cold : run;
+
+    printf("%-24s %16s %16s %16s\n", "stream", "overhead_ns", "before_ns", "after_ns");
+    for (size_t i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+        struct stream *s = &streams[i];
+
+        // Warm up both paths before measuring
+        measure(fn_before, s, reports / 10);
+        measure(fn_after, s, reports / 10);
+        struct cost overhead = cold ? measure(fn_empty, s, reports) : (struct cost) { 0, 0 };
+        struct cost before = minus_overhead(measure(fn_before, s, reports), overhead);
+        struct cost after = minus_overhead(measure(fn_after, s, reports), overhead);
+        printf("%-24s %8.2f +- %4.2f %8.2f +- %4.2f %8.2f +- %4.2f\n", s->name, overhead.ns, overhead.err,
+               before.ns, before.err, after.ns, after.err);
+    }
+    return mouse->malformed ? 1 : 0;
+}
@@ -0,0 +1,411 @@
+// Battery query benchmark across the implementations in this repository.
+//
+// Runs the same number of battery queries through each implementation against
+// one virtual mouse from uhid-sim with a fixed response delay, or against the
+// real mouse with -H, and prints one JSON object per implementation:
+//
+//   kernel   reads capacity of the hid-vxe-r1 power supply in lazy mode
+//            (lazy_ttl_ms=1), so every read makes the driver query the mouse
+//   hidraw   runs ./hidraw once per query
+//   libusb   runs ./libusb once per query, real hardware only
+//   go       runs ./go-libusb/battery -once per query, real hardware only
+//
+// The userspace tools are measured as one-shot processes, the way a cron job or
+// a monitoring agent would run them, so their latency includes process startup.
+// CPU time and wakeups (voluntary context switches) are those of the process,
+// for the kernel they are only the reading thread's; work done in kworkers is
+// not included. Syscalls are counted with strace -c on one extra query of the
+// userspace tools. The kernel is read in process, so it has no syscall count.
+//
+// Build: gcc -O2 -Wall bench-query.c -o bench-query
+//
+// Examples (as root, with the tools built next to this one):
+//   ./bench-query -d 5 -n 500 -o results.json    uhid-sim with a 5 ms response delay
+//   ./bench-query -H -i hidraw,libusb,go          the real mouse
+//
+// libusb and the Go tool talk to the USB device directly and can't see uhid
+// devices. The WebHID page in usbhid.html needs a browser and is not covered.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define LAZY_TTL_PARAM   "/sys/module/hid_vxe_r1/parameters/lazy_ttl_ms"
+#define POWER_SUPPLY_GLOB "/sys/class/power_supply/vxe_*_bat_*/capacity"
+
+// How long uhid-sim gets to create the mouse and the driver to take its first reading
+#define SIM_SETTLE_MS 1500
+
+struct options {
+    int queries;             // Measured queries per implementation
+    int gap_ms;              // Pause between queries, longer than lazy_ttl_ms
+    int delay_ms;            // Response delay of the simulated mouse
+    bool hardware;           // Use the real mouse instead of uhid-sim
+    bool strace;             // Count syscalls with strace
+    const char *impls;       // Comma separated implementations to run
+    const char *output;      // JSON output file, stdout if NULL
+};
+
+struct impl {
+    const char *name;
+    bool needs_usb;          // Can't run against uhid devices
+    const char *argv[4];     // Command relative to the tool directory, NULL for the kernel
+};
+
+static const struct impl impls[] = {
+    { "kernel", false, { NULL } },
+    { "hidraw", false, { "hidraw", NULL } },
+    { "libusb", true,  { "libusb", NULL } },
+    { "go",     true,  { "go-libusb/battery", "-once", NULL } },
+};
+
+// Costs of one implementation, summed over all queries
+struct result {
+    double *latency_us;
+    int done;
+    int failed;
+    double cpu_us;
+    long wakeups;
+    long syscalls;           // Of the strace'd query, -1 if not counted
+    const char *skipped;     // Reason the implementation didn't run
+};
+
+static char tool_dir[PATH_MAX];
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double rusage_cpu_us(const struct rusage *ru) {
+    return ru->ru_utime.tv_sec * 1e6 + ru->ru_utime.tv_usec + ru->ru_stime.tv_sec * 1e6 + ru->ru_stime.tv_usec;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+// Runs a command with its output discarded, returns its exit status or -1.
+// argv[0] is looked up in PATH unless it contains a slash.
+static int run(char *const argv[], struct rusage *ru) {
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    if (wait4(pid, &status, 0, ru) < 0)
+        return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Counts the syscalls of one run of a command from the total line of strace -c
+static long count_syscalls(char *const argv[]) {
+    char out[] = "/tmp/bench-query-XXXXXX";
+    int fd = mkstemp(out);
+    if (fd < 0)
+        return -1;
+    close(fd);
+
+    char *strace_argv[16] = { "strace", "-f", "-c", "-o", out };
+    int n = 5;
+    for (int i = 0; argv[i] && n < 15; i++)
+        strace_argv[n++] = argv[i];
+    strace_argv[n] = NULL;
+
+    struct rusage ru;
+    long calls = -1;
+    if (run(strace_argv, &ru) >= 0) {
+        FILE *f = fopen(out, "r");
+        char line[256];
+        while (f && fgets(line, sizeof(line), f)) {
+            double percent, seconds;
+            long usecs;
+            if (strstr(line, "total") && sscanf(line, "%lf %lf %ld %ld", &percent, &seconds, &usecs, &calls) != 4)
+                calls = -1;
+        }
+        if (f)
+            fclose(f);
+    }
+    unlink(out);
+    return calls;
+}
+
+static void bench_command(const struct impl *impl, const struct options *opts, struct result *res) {
+    char path[sizeof(tool_dir) + 32];
+    char *argv[4] = { path };
+    snprintf(path, sizeof(path), "%s/%s", tool_dir, impl->argv[0]);
+    for (int i = 1; i < 4; i++)
+        argv[i] = (char *)impl->argv[i];
+
+    if (access(path, X_OK) < 0) {
+        res->skipped = "not built";
+        return;
+    }
+
+    for (int i = 0; i < opts->queries; i++) {
+        struct rusage ru;
+        double start = now_us();
+        int status = run(argv, &ru);
+        double end = now_us();
+
+        if (status != 0) {
+            res->failed++;
+        } else {
+            res->latency_us[res->done++] = end - start;
+            res->cpu_us += rusage_cpu_us(&ru);
+            res->wakeups += ru.ru_nvcsw;
+        }
+        sleep_ms(opts->gap_ms);
+    }
+
+    if (opts->strace)
+        res->syscalls = count_syscalls(argv);
+}
+
+// Reads a small sysfs file, returns the number of bytes or -1
+static ssize_t sysfs_read(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n >= 0)
+        buf[n] = '\0';
+    return n;
+}
+
+static int sysfs_write(const char *path, const char *value) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+static void bench_kernel(const struct options *opts, struct result *res) {
+    char previous_ttl[32];
+    if (sysfs_read(LAZY_TTL_PARAM, previous_ttl, sizeof(previous_ttl)) < 0) {
+        res->skipped = "hid-vxe-r1 not loaded";
+        return;
+    }
+
+    glob_t g;
+    if (glob(POWER_SUPPLY_GLOB, 0, NULL, &g) != 0) {
+        res->skipped = "no power supply";
+        return;
+    }
+    char capacity[PATH_MAX];
+    snprintf(capacity, sizeof(capacity), "%s", g.gl_pathv[0]);
+    globfree(&g);
+
+    if (sysfs_write(LAZY_TTL_PARAM, "1") < 0) {
+        res->skipped = "can't enable lazy mode";
+        return;
+    }
+
+    for (int i = 0; i < opts->queries; i++) {
+        char buf[16];
+        struct rusage before, after;
+        getrusage(RUSAGE_THREAD, &before);
+        double start = now_us();
+        ssize_t n = sysfs_read(capacity, buf, sizeof(buf));
+        double end = now_us();
+        getrusage(RUSAGE_THREAD, &after);
+
+        if (n <= 0) {
+            res->failed++;
+        } else {
+            res->latency_us[res->done++] = end - start;
+            res->cpu_us += rusage_cpu_us(&after) - rusage_cpu_us(&before);
+            res->wakeups += after.ru_nvcsw - before.ru_nvcsw;
+        }
+        sleep_ms(opts->gap_ms);
+    }
+
+    sysfs_write(LAZY_TTL_PARAM, previous_ttl);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, int p) {
+    return n ? sorted[(n - 1) * p / 100] : 0;
+}
+
+static void print_result(FILE *out, const struct impl *impl, const struct options *opts, struct result *res) {
+    fprintf(out, "{\"impl\":\"%s\",\"target\":\"%s\",\"delay_ms\":%d,\"queries\":%d",
+            impl->name, opts->hardware ? "hardware" : "uhid", opts->hardware ? -1 : opts->delay_ms, opts->queries);
+    if (res->skipped) {
+        fprintf(out, ",\"skipped\":\"%s\"}\n", res->skipped);
+        fprintf(stderr, "%-8s skipped: %s\n", impl->name, res->skipped);
+        return;
+    }
+
+    int n = res->done;
+    qsort(res->latency_us, n, sizeof(double), compare_double);
+    double p50 = percentile(res->latency_us, n, 50), p99 = percentile(res->latency_us, n, 99);
+    double cpu = n ? res->cpu_us / n : 0, wakeups = n ? (double)res->wakeups / n : 0;
+
+    fprintf(out, ",\"failed\":%d,\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f,"
+            "\"cpu_us_per_query\":%.1f,\"wakeups_per_query\":%.2f",
+            res->failed, p50, p99, n ? res->latency_us[n - 1] : 0, cpu, wakeups);
+    if (res->syscalls >= 0)
+        fprintf(out, ",\"syscalls_per_query\":%ld", res->syscalls);
+    fprintf(out, "}\n");
+
+    fprintf(stderr, "%-8s p50 %8.1f us  p99 %8.1f us  cpu %8.1f us  wakeups %5.2f  failed %d\n",
+            impl->name, p50, p99, cpu, wakeups, res->failed);
+}
+
+// Starts one virtual mouse, returns its pid or -1
+static pid_t start_simulator(const struct options *opts) {
+    char sim[sizeof(tool_dir) + 32], descriptors[sizeof(tool_dir) + 32], delay[16];
+    snprintf(sim, sizeof(sim), "%s/uhid-sim", tool_dir);
+    snprintf(descriptors, sizeof(descriptors), "%s/../investigation", tool_dir);
+    snprintf(delay, sizeof(delay), "%d", opts->delay_ms);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execl(sim, sim, "-n", "1", "-r", "0", "-d", delay, "-D", descriptors, (char *)NULL);
+        perror(sim);
+        _exit(127);
+    }
+
+    sleep_ms(SIM_SETTLE_MS);
+    if (waitpid(pid, NULL, WNOHANG) != 0) {
+        fprintf(stderr, "uhid-sim exited, is it built and is /dev/uhid accessible?\n");
+        return -1;
+    }
+    return pid;
+}
+
+static bool selected(const char *list, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = list; (p = strstr(p, name)); p += len) {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+            return true;
+    }
+    return false;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n <queries>   queries per implementation (default 200)\n"
+            "  -g <ms>        pause between queries (default 10)\n"
+            "  -d <ms>        response delay of the simulated mouse (default 5)\n"
+            "  -H             use the real mouse instead of uhid-sim\n"
+            "  -s             count syscalls with strace\n"
+            "  -i <list>      implementations to run (default kernel,hidraw,libusb,go)\n"
+            "  -o <file>      write the JSON results to a file instead of stdout\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    struct options opts = {
+        .queries = 200,
+        .gap_ms = 10,
+        .delay_ms = 5,
+        .impls = "kernel,hidraw,libusb,go",
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:d:Hsi:o:h")) != -1) {
+        switch (opt) {
+        case 'n': opts.queries = atoi(optarg); break;
+        case 'g': opts.gap_ms = atoi(optarg); break;
+        case 'd': opts.delay_ms = atoi(optarg); break;
+        case 'H': opts.hardware = true; break;
+        case 's': opts.strace = true; break;
+        case 'i': opts.impls = optarg; break;
+        case 'o': opts.output = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.queries <= 0 || opts.gap_ms < 2) {
+        fprintf(stderr, "Need at least one query and a gap of 2 ms or more\n");
+        return 1;
+    }
+
+    // The other tools are looked up next to this one
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len < 0) {
+        perror("readlink");
+        return 1;
+    }
+    exe[len] = '\0';
+    snprintf(tool_dir, sizeof(tool_dir), "%s", dirname(exe));
+
+    FILE *out = stdout;
+    if (opts.output && !(out = fopen(opts.output, "w"))) {
+        perror(opts.output);
+        return 1;
+    }
+
+    pid_t sim = -1;
+    if (!opts.hardware && (sim = start_simulator(&opts)) < 0)
+        return 1;
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        const struct impl *impl = &impls[i];
+        if (!selected(opts.impls, impl->name))
+            continue;
+
+        struct result res = { .syscalls = -1 };
+        if (impl->needs_usb && !opts.hardware) {
+            res.skipped = "needs a real USB device";
+        } else {
+            res.latency_us = calloc(opts.queries, sizeof(double));
+            if (!res.latency_us) {
+                perror("calloc");
+                break;
+            }
+            if (impl->argv[0])
+                bench_command(impl, &opts, &res);
+            else
+                bench_kernel(&opts, &res);
+        }
+        print_result(out, impl, &opts, &res);
+        free(res.latency_us);
+    }
+
+    if (sim > 0) {
+        kill(sim, SIGTERM);
+        waitpid(sim, NULL, 0);
+    }
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,237 @@
+package main
+
+import (
+	"errors"
+	"log"
+	"math/bits"
+	"sync"
+	"time"
+
+	"github.com/karalabe/hid"
+)
+
+// How long to wait for the response to a battery query
+const responseTimeout = 500 * time.Millisecond
+
+// Latency histogram buckets, bucket i counts responses that took less than 2^i ms
+const latencyBuckets = 12
+
+var (
+	errTimeout = errors.New("no response to battery query")
+	errGone    = errors.New("device disconnected")
+)
+
+// reading is the last battery state reported by a device.
+type reading struct {
+	level     int
+	charging  bool
+	voltageMV int
+	at        time.Time // Zero if there was no reading yet
+}
+
+// metrics counts queries and their latency.
+type metrics struct {
+	requests   uint64
+	responses  uint64
+	lost       uint64
+	malformed  uint64
+	latency    [latencyBuckets]uint64
+	latencySum time.Duration
+}
+
+// hidDevice is the part of hid.Device the polling path uses, tests stub it.
+type hidDevice interface {
+	Read(b []byte) (int, error)
+	Write(b []byte) (int, error)
+	Close() error
+}
+
+// device is an open vendor interface with its reader goroutine.
+// Everything used on the polling path is allocated once in newDevice.
+type device struct {
+	info hid.DeviceInfo
+	dev  hidDevice
+
+	request  []byte
+	buf      []byte // Only touched by the reader goroutine
+	battery  batteryInfo
+	answered chan struct{} // Signalled by the reader when a battery response arrives
+	gone     chan struct{} // Closed by the reader when the device goes away
+	stop     chan struct{} // Closed by close to make the reader give up the device
+	timer    *time.Timer
+
+	mu      sync.Mutex // Protects everything below
+	pending bool
+	sentAt  time.Time
+	last    reading
+	stats   metrics
+}
+
+func openDevice(info hid.DeviceInfo) (*device, error) {
+	dev, err := info.Open()
+	if err != nil {
+		return nil, err
+	}
+	return newDevice(info, dev), nil
+}
+
+// newDevice sets up an opened device and starts its reader.
+func newDevice(info hid.DeviceInfo, dev hidDevice) *device {
+	d := &device{
+		info:     info,
+		dev:      dev,
+		request:  buildCommand(commandBattery),
+		buf:      make([]byte, vendorReportSize),
+		answered: make(chan struct{}, 1),
+		gone:     make(chan struct{}),
+		stop:     make(chan struct{}),
+		timer:    time.NewTimer(responseTimeout),
+	}
+	d.timer.Stop()
+	go d.readLoop()
+	return d
+}
+
+// close makes the reader close the device and waits for it. The reader may be
+// blocked in a read, so the mouse is queried once more to wake it up. If the
+// mouse doesn't answer in time, the device is left to the process exit.
+// Must not be called while a query is running.
+func (d *device) close() {
+	close(d.stop)
+	if _, err := d.dev.Write(d.request); err != nil {
+		return
+	}
+
+	d.timer.Reset(responseTimeout)
+	select {
+	case <-d.gone:
+		d.timer.Stop()
+	case <-d.timer.C:
+		log.Printf("%s: not closed, the reader is still blocked", d.info.Path)
+	}
+}
+
+// readLoop reads reports until the device goes away, matching battery
+// responses to the outstanding query. It owns closing the device, so a
+// blocking read is never racing a close.
+func (d *device) readLoop() {
+	defer close(d.gone)
+	defer d.dev.Close()
+
+	for {
+		n, err := d.dev.Read(d.buf)
+		select {
+		case <-d.stop:
+			return
+		default:
+		}
+		if err != nil {
+			log.Printf("%s: %v", d.info.Path, err)
+			return
+		}
+		if n == 0 {
+			continue
+		}
+
+		err = parseBattery(d.buf[:n], &d.battery)
+		now := time.Now()
+
+		d.mu.Lock()
+		if err != nil {
+			if err != errNotBattery {
+				d.stats.malformed++
+			}
+			d.mu.Unlock()
+			continue
+		}
+		changed := d.record(now)
+		d.mu.Unlock()
+
+		if changed {
+			log.Printf("%s: level %d%%, charging %t, %d mV", d.info.Path,
+				d.battery.level, charging(&d.battery), d.battery.voltage_mv)
+		}
+	}
+}
+
+// record stores a battery response and completes the pending query, if any.
+// Returns whether the level or charge state changed. Called with mu held.
+func (d *device) record(now time.Time) bool {
+	previous := d.last
+	d.last = reading{
+		level:     int(d.battery.level),
+		charging:  charging(&d.battery),
+		voltageMV: int(d.battery.voltage_mv),
+		at:        now,
+	}
+
+	if d.pending {
+		d.pending = false
+		d.stats.responses++
+		latency := now.Sub(d.sentAt)
+		d.stats.latencySum += latency
+		d.stats.latency[latencyBucket(latency)]++
+		select {
+		case d.answered <- struct{}{}:
+		default:
+		}
+	}
+
+	return previous.at.IsZero() || previous.level != d.last.level || previous.charging != d.last.charging
+}
+
+func latencyBucket(latency time.Duration) int {
+	bucket := bits.Len64(uint64(latency.Milliseconds()))
+	if bucket >= latencyBuckets {
+		bucket = latencyBuckets - 1
+	}
+	return bucket
+}
+
+// query sends a battery query and waits for the reader to see its response.
+// It does not allocate.
+func (d *device) query() error {
+	// Drop a late answer to an earlier query
+	select {
+	case <-d.answered:
+	default:
+	}
+
+	d.mu.Lock()
+	d.pending = true
+	d.sentAt = time.Now()
+	d.stats.requests++
+	d.mu.Unlock()
+
+	if _, err := d.dev.Write(d.request); err != nil {
+		d.mu.Lock()
+		d.pending = false
+		d.mu.Unlock()
+		return err
+	}
+
+	d.timer.Reset(responseTimeout)
+	select {
+	case <-d.answered:
+		d.timer.Stop()
+		return nil
+	case <-d.timer.C:
+		d.mu.Lock()
+		if d.pending {
+			d.pending = false
+			d.stats.lost++
+		}
+		d.mu.Unlock()
+		return errTimeout
+	case <-d.gone:
+		d.timer.Stop()
+		return errGone
+	}
+}
+
+// snapshot returns the last reading and the metrics.
+func (d *device) snapshot() (reading, metrics) {
+	d.mu.Lock()
+	defer d.mu.Unlock()
+	return d.last, d.stats
+}
@@ -0,0 +1,104 @@
+package main
+
+import (
+	"errors"
+	"testing"
+
+	"github.com/karalabe/hid"
+)
+
+// stubDevice answers every battery query with sampleBatteryResponse.
+type stubDevice struct {
+	queries chan struct{}
+	closed  chan struct{}
+}
+
+func newStubDevice() *stubDevice {
+	return &stubDevice{queries: make(chan struct{}, 1), closed: make(chan struct{})}
+}
+
+func (s *stubDevice) Write(b []byte) (int, error) {
+	select {
+	case s.queries <- struct{}{}:
+	default:
+	}
+	return len(b), nil
+}
+
+func (s *stubDevice) Read(b []byte) (int, error) {
+	select {
+	case <-s.queries:
+		return copy(b, sampleBatteryResponse), nil
+	case <-s.closed:
+		return 0, errors.New("closed")
+	}
+}
+
+func (s *stubDevice) Close() error {
+	close(s.closed)
+	return nil
+}
+
+func openStub(t testing.TB) *device {
+	d := newDevice(hid.DeviceInfo{Path: "stub"}, newStubDevice())
+	t.Cleanup(d.close)
+	return d
+}
+
+func TestQuery(t *testing.T) {
+	d := openStub(t)
+	if err := d.query(); err != nil {
+		t.Fatal(err)
+	}
+
+	r, m := d.snapshot()
+	if r.level != 65 || r.charging || r.voltageMV != 3971 {
+		t.Errorf("got level %d, charging %t, %d mV, want 65, false, 3971", r.level, r.charging, r.voltageMV)
+	}
+	if m.requests != 1 || m.responses != 1 || m.lost != 0 || m.malformed != 0 {
+		t.Errorf("got %+v, want one answered request", m)
+	}
+}
+
+// Polling must not allocate once the device is open
+func TestQueryAllocs(t *testing.T) {
+	d := openStub(t)
+	// The first response is logged, which allocates
+	if err := d.query(); err != nil {
+		t.Fatal(err)
+	}
+
+	allocs := testing.AllocsPerRun(1000, func() {
+		if err := d.query(); err != nil {
+			t.Fatal(err)
+		}
+	})
+	if allocs != 0 {
+		t.Errorf("query allocates %v times, want 0", allocs)
+	}
+}
+
+func TestClose(t *testing.T) {
+	d := newDevice(hid.DeviceInfo{Path: "stub"}, newStubDevice())
+	d.close()
+	select {
+	case <-d.gone:
+	default:
+		t.Fatal("reader still running after close")
+	}
+}
+
+func BenchmarkQuery(b *testing.B) {
+	d := openStub(b)
+	if err := d.query(); err != nil {
+		b.Fatal(err)
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if err := d.query(); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
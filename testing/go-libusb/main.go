@@ -1,8 +1,13 @@
 package main
 
 import (
-	"fmt"
+	"flag"
 	"log"
+	"os"
+	"os/signal"
+	"path/filepath"
+	"sync"
+	"syscall"
 	"time"
 
 	"github.com/karalabe/hid"
@@ -11,40 +16,20 @@ import (
 const (
 	// Mouse vendorID
 	vendorID uint16 = 0x3554
-	// Mouse productID
+	// Mouse productID through the wireless dongle
 	productID uint16 = 0xf58a
+	// Mouse productID when plugged in by cable
+	wiredProductID uint16 = 0xf58c
+	// Only this interface answers vendor reports
+	vendorInterface = 1
 	// The name that will appear in UPower
 	deviceName = "VXE Dragonfly R1 Pro Max"
 	// How often to check the battery
 	pollInterval = 120 * time.Second
+	// How often to look for newly plugged in mice
+	rescanInterval = 5 * time.Second
 )
 
-const batteryQueryReportId = 0x8
-const batteryQueryResponseId = 0x8
-
-const offset = 5
-const packetSize = 17
-
-var batteryRequestReport = []byte{
-	batteryQueryReportId, // Report ID
-	0x04,                 // Most likely the Command ID
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x00,
-	0x49,
-}
-
 var sampleBatteryResponse = []byte{
 	0x08, // Report ID
 	0x04, // Command ID
@@ -65,66 +50,164 @@ var sampleBatteryResponse = []byte{
 	0x74, // Checksum
 }
 
-// getBatteryLevel sends the request and parses the battery level from the response.
-func getBatteryLevel(device *hid.Device) (level int, status string, err error) {
-	// Send the battery query request
-	_, err = device.Write(batteryRequestReport)
-	if err != nil {
-		return 0, "Unknown", fmt.Errorf("failed to send feature report: %w", err)
-	}
+// service keeps every mouse on the machine open and polls it.
+type service struct {
+	interval time.Duration
+	stop     chan struct{}  // Closed to stop polling
+	pollers  sync.WaitGroup // One per open device
 
-	// Give the device a moment to process
-	time.Sleep(50 * time.Millisecond)
+	mu      sync.Mutex
+	devices map[string]*device // By hidapi path
+}
 
-	// Buffer to read the response
-	response := make([]byte, packetSize)
-	_, err = device.Read(response)
-	if err != nil {
-		return 0, "Unknown", fmt.Errorf("failed to read response: %w", err)
+// vendorInterfaces lists the vendor interface of every attached mouse.
+// hidapi enumerates each interface separately, only interface 1 takes vendor reports.
+func vendorInterfaces() []hid.DeviceInfo {
+	var found []hid.DeviceInfo
+	for _, info := range hid.Enumerate(vendorID, 0) {
+		if info.Interface != vendorInterface {
+			continue
+		}
+		if info.ProductID != productID && info.ProductID != wiredProductID {
+			continue
+		}
+		found = append(found, info)
 	}
+	return found
+}
 
-	if len(response) == packetSize && response[0] == batteryQueryResponseId {
-		batteryLevel := response[offset+1]
-		batteryCharge := response[offset+2]
-		batteryVoltage := (int(response[offset+3]) << 8) | int(response[offset+4])
+// scan opens mice that are not open yet and starts polling them.
+func (s *service) scan() {
+	for _, info := range vendorInterfaces() {
+		s.mu.Lock()
+		_, open := s.devices[info.Path]
+		s.mu.Unlock()
+		if open {
+			continue
+		}
 
-		fmt.Println(len(response), response)
-		log.Printf("Battery Level: %d%%\n", batteryLevel)
-		log.Printf("Battery Charge: %d\n", batteryCharge)
-		log.Printf("Battery Voltage: %d mV\n", batteryVoltage)
+		d, err := openDevice(info)
+		if err != nil {
+			log.Printf("Error opening %s: %v", info.Path, err)
+			continue
+		}
+		log.Printf("Opened %s %s at %s", info.Manufacturer, info.Product, info.Path)
+
+		s.mu.Lock()
+		s.devices[info.Path] = d
+		s.mu.Unlock()
+		s.pollers.Add(1)
+		go s.poll(d)
 	}
-	return 0, "Unknown", fmt.Errorf("unexpected response: %x", response)
 }
 
-func main() {
+// close stops polling and closes every open device.
+func (s *service) close() {
+	close(s.stop)
+	s.pollers.Wait()
 
-	devices := hid.Enumerate(vendorID, productID)
-	if len(devices) == 0 {
-		log.Fatalf("Error: No HID devices found with VID=%#x PID=%#x.", vendorID, productID)
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	for path, d := range s.devices {
+		d.close()
+		delete(s.devices, path)
 	}
-	log.Printf("Found %d HID devices named %s %s.", len(devices), devices[0].Manufacturer, devices[0].Product)
+}
 
-	// TODO: figure out how to get the specific device that works without resorting to specifying the path
-	for _, device := range devices {
-		if device.Interface != 1 {
-			continue
+// poll queries a device every interval until it goes away.
+func (s *service) poll(d *device) {
+	defer s.pollers.Done()
+	ticker := time.NewTicker(s.interval)
+	defer ticker.Stop()
+
+	for {
+		if err := d.query(); err != nil && err != errGone {
+			log.Printf("%s: %v", d.info.Path, err)
 		}
-		log.Println("Opening device at", device.Path)
 
-		openDev, err := device.Open()
-		if err != nil {
-			log.Fatalf("Error opening device: %v", err)
+		select {
+		case <-ticker.C:
+		case <-s.stop:
+			return
+		case <-d.gone:
+			log.Printf("Closed %s", d.info.Path)
+			s.mu.Lock()
+			delete(s.devices, d.info.Path)
+			s.mu.Unlock()
+			return
 		}
+	}
+}
 
-		// Query the battery level
-		level, status, err := getBatteryLevel(openDev)
+// queryOnce queries every mouse once and prints the result.
+func queryOnce() int {
+	infos := vendorInterfaces()
+	if len(infos) == 0 {
+		log.Printf("Error: No %s found with VID=%#x.", deviceName, vendorID)
+		return 1
+	}
+
+	status := 0
+	for _, info := range infos {
+		d, err := openDevice(info)
 		if err != nil {
-			log.Printf("Error getting battery level: %v", err)
+			log.Printf("Error opening %s: %v", info.Path, err)
+			status = 1
+			continue
+		}
+		err = d.query()
+		if err == nil {
+			r, _ := d.snapshot()
+			log.Printf("%s: Battery Level: %d%%, Charging: %t, Voltage: %d mV", info.Path, r.level, r.charging, r.voltageMV)
 		} else {
-			log.Printf("Battery Level: %d%%, Status: %s", level, status)
+			log.Printf("Error getting battery level from %s: %v", info.Path, err)
+			status = 1
 		}
+		d.close()
+	}
+	return status
+}
 
-		openDev.Close()
-		break
+func defaultSocket() string {
+	if dir := os.Getenv("XDG_RUNTIME_DIR"); dir != "" {
+		return filepath.Join(dir, "vxe-battery.sock")
+	}
+	return filepath.Join(os.TempDir(), "vxe-battery.sock")
+}
+
+func main() {
+	once := flag.Bool("once", false, "query every mouse once and exit")
+	interval := flag.Duration("interval", pollInterval, "battery polling interval")
+	socket := flag.String("socket", defaultSocket(), "unix socket serving readings and metrics, empty to disable")
+	flag.Parse()
+
+	if *once {
+		os.Exit(queryOnce())
+	}
+
+	s := &service{interval: *interval, stop: make(chan struct{}), devices: make(map[string]*device)}
+
+	if *socket != "" {
+		listener, err := listenMetrics(*socket, s)
+		if err != nil {
+			log.Fatalf("Error listening on %s: %v", *socket, err)
+		}
+		defer listener.Close()
+	}
+
+	signals := make(chan os.Signal, 1)
+	signal.Notify(signals, syscall.SIGINT, syscall.SIGTERM)
+
+	rescan := time.NewTicker(rescanInterval)
+	defer rescan.Stop()
+
+	for {
+		s.scan()
+		select {
+		case <-rescan.C:
+		case <-signals:
+			s.close()
+			return
+		}
 	}
 }
@@ -0,0 +1,98 @@
+package main
+
+import (
+	"bufio"
+	"fmt"
+	"log"
+	"net"
+	"os"
+	"sort"
+	"time"
+)
+
+// listenMetrics serves the current readings and query metrics on a unix
+// socket. Every connection gets one snapshot in the Prometheus text format
+// and is closed, e.g. `socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/vxe-battery.sock`.
+func listenMetrics(path string, s *service) (net.Listener, error) {
+	// Remove a socket left behind by a previous run
+	if err := os.Remove(path); err != nil && !os.IsNotExist(err) {
+		return nil, err
+	}
+	listener, err := net.Listen("unix", path)
+	if err != nil {
+		return nil, err
+	}
+	if err := os.Chmod(path, 0600); err != nil {
+		listener.Close()
+		return nil, err
+	}
+
+	go func() {
+		for {
+			conn, err := listener.Accept()
+			if err != nil {
+				if ne, ok := err.(net.Error); ok && ne.Timeout() {
+					continue
+				}
+				return
+			}
+			go func() {
+				defer conn.Close()
+				conn.SetWriteDeadline(time.Now().Add(time.Second))
+				if err := s.writeMetrics(conn); err != nil {
+					log.Printf("Error writing metrics: %v", err)
+				}
+			}()
+		}
+	}()
+	return listener, nil
+}
+
+// writeMetrics writes a snapshot of every open device.
+func (s *service) writeMetrics(conn net.Conn) error {
+	s.mu.Lock()
+	devices := make([]*device, 0, len(s.devices))
+	for _, d := range s.devices {
+		devices = append(devices, d)
+	}
+	s.mu.Unlock()
+	sort.Slice(devices, func(i, j int) bool { return devices[i].info.Path < devices[j].info.Path })
+
+	w := bufio.NewWriter(conn)
+	now := time.Now()
+	for _, d := range devices {
+		r, m := d.snapshot()
+		labels := fmt.Sprintf("{device=%q,product=\"%04x\",name=%q}", d.info.Path, d.info.ProductID, deviceName)
+
+		if !r.at.IsZero() {
+			fmt.Fprintf(w, "vxe_battery_level_percent%s %d\n", labels, r.level)
+			fmt.Fprintf(w, "vxe_battery_charging%s %d\n", labels, boolToInt(r.charging))
+			fmt.Fprintf(w, "vxe_battery_voltage_mv%s %d\n", labels, r.voltageMV)
+			fmt.Fprintf(w, "vxe_battery_age_seconds%s %.3f\n", labels, now.Sub(r.at).Seconds())
+		}
+		fmt.Fprintf(w, "vxe_battery_requests_total%s %d\n", labels, m.requests)
+		fmt.Fprintf(w, "vxe_battery_responses_total%s %d\n", labels, m.responses)
+		fmt.Fprintf(w, "vxe_battery_lost_total%s %d\n", labels, m.lost)
+		fmt.Fprintf(w, "vxe_battery_malformed_total%s %d\n", labels, m.malformed)
+
+		// Cumulative histogram, the last bucket also holds everything slower
+		var cumulative uint64
+		for i := 0; i < latencyBuckets-1; i++ {
+			cumulative += m.latency[i]
+			fmt.Fprintf(w, "vxe_battery_latency_ms_bucket{device=%q,le=\"%d\"} %d\n", d.info.Path, 1<<i, cumulative)
+		}
+		cumulative += m.latency[latencyBuckets-1]
+		fmt.Fprintf(w, "vxe_battery_latency_ms_bucket{device=%q,le=\"+Inf\"} %d\n", d.info.Path, cumulative)
+		fmt.Fprintf(w, "vxe_battery_latency_ms_sum{device=%q} %.3f\n", d.info.Path,
+			float64(m.latencySum)/float64(time.Millisecond))
+		fmt.Fprintf(w, "vxe_battery_latency_ms_count{device=%q} %d\n", d.info.Path, cumulative)
+	}
+	return w.Flush()
+}
+
+func boolToInt(b bool) int {
+	if b {
+		return 1
+	}
+	return 0
+}
@@ -0,0 +1,60 @@
+package main
+
+// The protocol definitions are shared with the kernel module and the C tools.
+
+// #cgo CFLAGS: -I${SRCDIR}/../../module
+// #include "vxe-protocol.h"
+import "C"
+
+import (
+	"errors"
+	"unsafe"
+)
+
+const (
+	// Report ID of vendor requests and responses
+	vendorReportID = C.VXE_REPORT_ID
+	// Size of a vendor report including the report ID
+	vendorReportSize = C.VXE_REPORT_SIZE
+	// Battery query command
+	commandBattery = C.VXE_CMD_BATTERY
+)
+
+// buildCommand builds the vendor report for a command, checksum included.
+func buildCommand(command byte) []byte {
+	report := make([]byte, vendorReportSize)
+	C.vxe_build_command((*C.uint8_t)(unsafe.Pointer(&report[0])), C.uint8_t(command))
+	return report
+}
+
+// batteryInfo is a decoded battery response.
+type batteryInfo = C.struct_vxe_battery_info
+
+var (
+	errNotBattery = errors.New("not a battery response")
+	errBadSize    = errors.New("truncated or oversized report")
+	errBadValue   = errors.New("battery values out of range")
+)
+
+// parseBattery decodes a battery response into info. Both must already live on
+// the heap, passing them to C makes them escape and would allocate otherwise.
+func parseBattery(report []byte, info *batteryInfo) error {
+	if len(report) == 0 {
+		return errBadSize
+	}
+	switch C.vxe_parse_battery((*C.uint8_t)(unsafe.Pointer(&report[0])), C.int(len(report)), info) {
+	case 0:
+		return nil
+	case -C.EMSGSIZE:
+		return errBadSize
+	case -C.ERANGE:
+		return errBadValue
+	default:
+		return errNotBattery
+	}
+}
+
+// charging reports whether the battery is being charged.
+func charging(info *batteryInfo) bool {
+	return bool(C.vxe_battery_charging(info))
+}
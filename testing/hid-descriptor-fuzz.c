@@ -0,0 +1,236 @@
+// Fuzzes the report descriptor parser of hid-descriptor.h.
+//
+// Build: gcc -O1 -g -fsanitize=address,undefined -fno-sanitize-recover=all
+//            hid-descriptor-fuzz.c -o hid-descriptor-fuzz
+//    or: clang -O1 -g -fsanitize=fuzzer,address,undefined -DLIBFUZZER
+//            hid-descriptor-fuzz.c -o hid-descriptor-fuzz
+//
+// Usage: ./hid-descriptor-fuzz [-n iterations] [-s seed] <descriptor>...
+//
+// Standalone, the descriptors (in the commented hex format of
+// investigation/int0..2) are mutated with a fixed seed, so a run is
+// reproducible: bit flips, random bytes, inserted and deleted bytes, item
+// prefixes that open and close collections or push and pop, long items and
+// truncation. Every mutated descriptor is copied into a buffer of its exact
+// size, so the sanitizers catch any read past its end. Built with -DLIBFUZZER
+// the same check is the libFuzzer entry point, with the descriptors as corpus.
+//
+// Each descriptor is parsed directly and through the layout cache. The parse
+// must return one of the documented errors, stay within the layout's bounds
+// and agree with the cache.
+//
+// Example: ./hid-descriptor-fuzz -n 3000000 ../investigation/int*
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hid-descriptor.h"
+
+// Large enough for any descriptor the kernel accepts (HID_MAX_DESCRIPTOR_SIZE)
+#define MAX_DESCRIPTOR_SIZE 4096
+
+static struct hid_layout_cache cache;
+
+static void fail(const char *what, const uint8_t *desc, size_t size) {
+    fprintf(stderr, "%s, descriptor of %zu bytes:\n", what, size);
+    for (size_t i = 0; i < size; i++)
+        fprintf(stderr, "0x%02x%s", desc[i], i % 16 == 15 || i == size - 1 ? "\n" : " ");
+    abort();
+}
+
+// Parses a descriptor and checks the result, aborts on a bug. Returns what the parser did.
+static int check_descriptor(const uint8_t *desc, size_t size) {
+    struct hid_layout layout;
+    int ret = hid_parse_layout(desc, size, &layout);
+
+    if (ret != 0 && ret != -EINVAL && ret != -E2BIG && ret != -ERANGE)
+        fail("unexpected return value", desc, size);
+    if (layout.fingerprint != hid_descriptor_fingerprint(desc, size))
+        fail("wrong fingerprint", desc, size);
+    if (layout.collection_count > HID_LAYOUT_MAX_COLLECTIONS || layout.report_count > HID_LAYOUT_MAX_REPORTS)
+        fail("layout overflowed", desc, size);
+
+    // The cache must return the same layout, or none for a malformed descriptor
+    const struct hid_layout *cached = hid_layout_cache_get(&cache, desc, size);
+    if (!cached != (ret != 0))
+        fail("cache disagrees with the parser", desc, size);
+    if (cached && (cached->collection_count != layout.collection_count ||
+                   cached->report_count != layout.report_count ||
+                   memcmp(cached->reports, layout.reports, layout.report_count * sizeof(layout.reports[0]))))
+        fail("cached layout differs", desc, size);
+    return ret;
+}
+
+#ifdef LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    check_descriptor(data, size);
+    return 0;
+}
+
+#else
+
+// xorshift64, the same on every libc so a seed always gives the same run
+static uint64_t rng_state;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state >> 32;
+}
+
+// Reads the 0xNN bytes of a descriptor, ignoring // comments. Returns the size or -1
+static ssize_t read_descriptor(const char *path, uint8_t *desc, size_t size) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    size_t len = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *comment = strstr(line, "//");
+        if (comment)
+            *comment = '\0';
+
+        for (char *p = line; (p = strcasestr(p, "0x")); ) {
+            char *end;
+            unsigned long byte = strtoul(p, &end, 16);
+            if (end == p + 2 || byte > 0xFF || len == size) {
+                fprintf(stderr, "%s: bad descriptor byte\n", path);
+                fclose(f);
+                return -1;
+            }
+            desc[len++] = byte;
+            p = end;
+        }
+    }
+    fclose(f);
+    return len;
+}
+
+// Item prefixes that change the parser's state: Collection, End Collection,
+// Push, Pop, Report ID, Report Size, Report Count, Usage and a long item
+static const uint8_t interesting_prefixes[] = { 0xA1, 0xC0, 0xA4, 0xB4, 0x85, 0x75, 0x95, 0x09, 0xFE };
+
+// Applies one to four random mutations to a descriptor, returns its new size
+static size_t mutate(uint8_t *desc, size_t size) {
+    int mutations = 1 + rng() % 4;
+
+    for (int m = 0; m < mutations; m++) {
+        size_t pos = size ? rng() % size : 0;
+        uint32_t kind = rng() % 7;
+
+        switch (kind) {
+        case 0: // Flip a bit
+            if (size)
+                desc[pos] ^= 1 << (rng() % 8);
+            break;
+        case 1: // Random byte
+            if (size)
+                desc[pos] = rng();
+            break;
+        case 2: // Insert a byte
+        case 3: // Insert an item prefix
+            if (size < MAX_DESCRIPTOR_SIZE) {
+                memmove(desc + pos + 1, desc + pos, size - pos);
+                desc[pos] = kind == 2 ? rng()
+                          : interesting_prefixes[rng() % sizeof(interesting_prefixes)];
+                size++;
+            }
+            break;
+        case 4: // Delete a byte
+            if (size) {
+                memmove(desc + pos, desc + pos + 1, size - pos - 1);
+                size--;
+            }
+            break;
+        case 5: // Duplicate a chunk, e.g. a whole collection
+            if (size) {
+                size_t len = 1 + rng() % (size - pos < 32 ? size - pos : 32);
+                if (size + len <= MAX_DESCRIPTOR_SIZE) {
+                    size_t to = rng() % (size + 1);
+                    uint8_t chunk[32];
+                    memcpy(chunk, desc + pos, len);
+                    memmove(desc + to + len, desc + to, size - to);
+                    memcpy(desc + to, chunk, len);
+                    size += len;
+                }
+            }
+            break;
+        case 6: // Truncate
+            size = pos;
+            break;
+        }
+    }
+    return size;
+}
+
+int main(int argc, char **argv) {
+    long iterations = 1000000;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atol(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations] [-s seed] <descriptor>...\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "Usage: %s [-n iterations] [-s seed] <descriptor>...\n", argv[0]);
+        return 1;
+    }
+
+    int seed_count = argc - optind;
+    uint8_t (*seeds)[MAX_DESCRIPTOR_SIZE] = calloc(seed_count, MAX_DESCRIPTOR_SIZE);
+    size_t *seed_sizes = calloc(seed_count, sizeof(*seed_sizes));
+    if (!seeds || !seed_sizes) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < seed_count; i++) {
+        ssize_t size = read_descriptor(argv[optind + i], seeds[i], MAX_DESCRIPTOR_SIZE);
+        if (size < 0)
+            return 1;
+        seed_sizes[i] = size;
+        check_descriptor(seeds[i], size);
+    }
+
+    // xorshift must not start from 0
+    rng_state = seed ? seed : 1;
+
+    uint8_t work[MAX_DESCRIPTOR_SIZE];
+    long rejected = 0;
+    for (long n = 0; n < iterations; n++) {
+        int i = rng() % seed_count;
+        memcpy(work, seeds[i], seed_sizes[i]);
+        size_t size = mutate(work, seed_sizes[i]);
+
+        // An exact size allocation, so reading past the end is caught
+        uint8_t *desc = malloc(size ? size : 1);
+        if (!desc) {
+            perror("malloc");
+            return 1;
+        }
+        memcpy(desc, work, size);
+        rejected += check_descriptor(desc, size) != 0;
+        free(desc);
+    }
+
+    printf("%ld descriptors from %d seeds with seed %llu, %ld rejected as malformed\n", iterations, seed_count,
+           (unsigned long long)seed, rejected);
+    free(seeds);
+    free(seed_sizes);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,319 @@
+// HID report descriptor parser for the userspace tools.
+//
+// Builds a compact layout of a report descriptor in a single pass: the
+// top-level collections and the size of every input, output and feature
+// report. Every item is bounds checked, long items are skipped and malformed
+// descriptors are rejected instead of being read past their end.
+//
+// Layouts are keyed by a fingerprint of the descriptor bytes and kept in a
+// small hash table, so a descriptor seen before (e.g. the same mouse showing
+// up again, or several identical mice) costs one hash and one lookup.
+
+#ifndef _HID_DESCRIPTOR_H
+#define _HID_DESCRIPTOR_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HID_LAYOUT_MAX_COLLECTIONS 16
+#define HID_LAYOUT_MAX_REPORTS     32
+// Depth of the Push/Pop stack for global items
+#define HID_GLOBAL_STACK_DEPTH     4
+// Number of layouts in a cache, must be a power of two
+#define HID_LAYOUT_CACHE_SIZE      64
+
+enum hid_report_kind {
+    HID_REPORT_INPUT,
+    HID_REPORT_OUTPUT,
+    HID_REPORT_FEATURE,
+};
+
+struct hid_layout_collection {
+    uint16_t usage_page;
+    uint16_t usage;
+    uint8_t type;            // Physical, Application, ...
+};
+
+struct hid_layout_report {
+    uint8_t id;              // 0 if the descriptor has no report IDs
+    uint8_t kind;            // enum hid_report_kind
+    uint16_t values;         // Sum of the report counts of all fields
+    uint32_t bits;           // Size without the report ID
+};
+
+struct hid_layout {
+    uint64_t fingerprint;
+    uint8_t collection_count; // Top-level collections only
+    uint8_t report_count;
+    struct hid_layout_collection collections[HID_LAYOUT_MAX_COLLECTIONS];
+    struct hid_layout_report reports[HID_LAYOUT_MAX_REPORTS];
+};
+
+// Global items that Push and Pop save and restore
+struct hid_globals {
+    uint16_t usage_page;
+    uint8_t report_id;
+    uint32_t report_size;
+    uint32_t report_count;
+};
+
+struct hid_parser {
+    struct hid_layout *layout;
+    struct hid_globals globals;
+    struct hid_globals stack[HID_GLOBAL_STACK_DEPTH];
+    int stack_depth;
+    int collection_depth;
+    uint32_t usage;          // First usage of the current main item, page in the high half if given
+    bool has_usage;
+};
+
+// 64-bit FNV-1a over the descriptor bytes
+static inline uint64_t hid_descriptor_fingerprint(const uint8_t *desc, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= desc[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Item handlers return 0 or a negative errno that stops the parse
+typedef int (*hid_item_handler)(struct hid_parser *parser, uint32_t value);
+
+static inline int hid_field(struct hid_parser *parser, enum hid_report_kind kind) {
+    struct hid_layout *layout = parser->layout;
+    struct hid_layout_report *report = NULL;
+
+    for (int i = 0; i < layout->report_count; ++i) {
+        if (layout->reports[i].kind == kind && layout->reports[i].id == parser->globals.report_id) {
+            report = &layout->reports[i];
+            break;
+        }
+    }
+    if (!report) {
+        if (layout->report_count == HID_LAYOUT_MAX_REPORTS)
+            return -E2BIG;
+        report = &layout->reports[layout->report_count++];
+        report->id = parser->globals.report_id;
+        report->kind = kind;
+    }
+
+    // Reports are at most a few kB, anything bigger is garbage
+    uint64_t bits = (uint64_t)parser->globals.report_size * parser->globals.report_count;
+    if (report->bits + bits > UINT16_MAX * 8ULL || report->values + parser->globals.report_count > UINT16_MAX)
+        return -ERANGE;
+    report->bits += bits;
+    report->values += parser->globals.report_count;
+    return 0;
+}
+
+static inline int hid_input(struct hid_parser *parser, uint32_t value) {
+    (void)value;
+    return hid_field(parser, HID_REPORT_INPUT);
+}
+
+static inline int hid_output(struct hid_parser *parser, uint32_t value) {
+    (void)value;
+    return hid_field(parser, HID_REPORT_OUTPUT);
+}
+
+static inline int hid_feature(struct hid_parser *parser, uint32_t value) {
+    (void)value;
+    return hid_field(parser, HID_REPORT_FEATURE);
+}
+
+static inline int hid_collection(struct hid_parser *parser, uint32_t value) {
+    struct hid_layout *layout = parser->layout;
+
+    if (parser->collection_depth++ > 0)
+        return 0;
+    if (layout->collection_count == HID_LAYOUT_MAX_COLLECTIONS)
+        return -E2BIG;
+
+    struct hid_layout_collection *collection = &layout->collections[layout->collection_count++];
+    collection->usage_page = parser->has_usage && parser->usage > 0xFFFF ? parser->usage >> 16 : parser->globals.usage_page;
+    collection->usage = parser->usage & 0xFFFF;
+    collection->type = value;
+    return 0;
+}
+
+static inline int hid_end_collection(struct hid_parser *parser, uint32_t value) {
+    (void)value;
+    if (parser->collection_depth == 0)
+        return -EINVAL;
+    parser->collection_depth--;
+    return 0;
+}
+
+static inline int hid_usage_page(struct hid_parser *parser, uint32_t value) {
+    parser->globals.usage_page = value;
+    return 0;
+}
+
+static inline int hid_report_size(struct hid_parser *parser, uint32_t value) {
+    parser->globals.report_size = value;
+    return 0;
+}
+
+static inline int hid_report_id(struct hid_parser *parser, uint32_t value) {
+    if (value == 0 || value > 0xFF)
+        return -EINVAL;
+    parser->globals.report_id = value;
+    return 0;
+}
+
+static inline int hid_report_count(struct hid_parser *parser, uint32_t value) {
+    parser->globals.report_count = value;
+    return 0;
+}
+
+static inline int hid_push(struct hid_parser *parser, uint32_t value) {
+    (void)value;
+    if (parser->stack_depth == HID_GLOBAL_STACK_DEPTH)
+        return -E2BIG;
+    parser->stack[parser->stack_depth++] = parser->globals;
+    return 0;
+}
+
+static inline int hid_pop(struct hid_parser *parser, uint32_t value) {
+    (void)value;
+    if (parser->stack_depth == 0)
+        return -EINVAL;
+    parser->globals = parser->stack[--parser->stack_depth];
+    return 0;
+}
+
+static inline int hid_usage(struct hid_parser *parser, uint32_t value) {
+    if (!parser->has_usage) {
+        parser->usage = value;
+        parser->has_usage = true;
+    }
+    return 0;
+}
+
+// Short items are looked up by the upper six bits of their prefix, the tag and the type
+#define HID_ITEM_MAIN(tag)   (((tag) << 2) | 0x0)
+#define HID_ITEM_GLOBAL(tag) (((tag) << 2) | 0x1)
+#define HID_ITEM_LOCAL(tag)  (((tag) << 2) | 0x2)
+#define HID_PREFIX_LONG_ITEM 0xFE
+
+static const hid_item_handler hid_item_handlers[64] = {
+    [HID_ITEM_MAIN(0x8)]   = hid_input,
+    [HID_ITEM_MAIN(0x9)]   = hid_output,
+    [HID_ITEM_MAIN(0xA)]   = hid_collection,
+    [HID_ITEM_MAIN(0xB)]   = hid_feature,
+    [HID_ITEM_MAIN(0xC)]   = hid_end_collection,
+    [HID_ITEM_GLOBAL(0x0)] = hid_usage_page,
+    [HID_ITEM_GLOBAL(0x7)] = hid_report_size,
+    [HID_ITEM_GLOBAL(0x8)] = hid_report_id,
+    [HID_ITEM_GLOBAL(0x9)] = hid_report_count,
+    [HID_ITEM_GLOBAL(0xA)] = hid_push,
+    [HID_ITEM_GLOBAL(0xB)] = hid_pop,
+    [HID_ITEM_LOCAL(0x0)]  = hid_usage,
+};
+
+/*
+ * Parses a report descriptor into layout. Returns 0 on success, -EINVAL if
+ * the descriptor is truncated or its collections or Push/Pop are unbalanced,
+ * -E2BIG if it has more collections, reports or pushes than fit and -ERANGE
+ * if a report is unreasonably large.
+ */
+static inline int hid_parse_layout(const uint8_t *desc, size_t size, struct hid_layout *layout) {
+    struct hid_parser parser = { .layout = layout };
+
+    memset(layout, 0, sizeof(*layout));
+    layout->fingerprint = hid_descriptor_fingerprint(desc, size);
+
+    size_t i = 0;
+    while (i < size) {
+        uint8_t prefix = desc[i];
+
+        if (prefix == HID_PREFIX_LONG_ITEM) {
+            // Prefix, data size, long tag and the data, nothing uses them
+            if (size - i < 3 || size - i - 3 < desc[i + 1])
+                return -EINVAL;
+            i += 3 + desc[i + 1];
+            continue;
+        }
+
+        static const uint8_t data_sizes[4] = { 0, 1, 2, 4 };
+        size_t data_len = data_sizes[prefix & 0x03];
+        if (size - i - 1 < data_len)
+            return -EINVAL;
+
+        uint32_t value = 0;
+        for (size_t j = 0; j < data_len; ++j)
+            value |= (uint32_t)desc[i + 1 + j] << (j * 8);
+        i += 1 + data_len;
+
+        hid_item_handler handler = hid_item_handlers[prefix >> 2];
+        if (handler) {
+            int ret = handler(&parser, value);
+            if (ret)
+                return ret;
+        }
+
+        // Local items only apply to the next main item
+        if ((prefix & 0x0C) == 0x00) {
+            parser.usage = 0;
+            parser.has_usage = false;
+        }
+    }
+
+    if (parser.collection_depth != 0)
+        return -EINVAL;
+    return 0;
+}
+
+// Returns the report of a kind with an ID, or NULL if the layout has none
+static inline const struct hid_layout_report *hid_layout_report(const struct hid_layout *layout,
+                                                                enum hid_report_kind kind, uint8_t id) {
+    for (int i = 0; i < layout->report_count; ++i) {
+        if (layout->reports[i].kind == kind && layout->reports[i].id == id)
+            return &layout->reports[i];
+    }
+    return NULL;
+}
+
+struct hid_layout_cache {
+    struct hid_layout layouts[HID_LAYOUT_CACHE_SIZE];
+    bool used[HID_LAYOUT_CACHE_SIZE];
+};
+
+/*
+ * Returns the layout of a descriptor, parsing it only if its fingerprint is
+ * not in the cache yet. Returns NULL if the descriptor is malformed. The
+ * layout stays valid until the cache slot is reused, which only happens
+ * once the cache is full.
+ */
+static inline const struct hid_layout *hid_layout_cache_get(struct hid_layout_cache *cache, const uint8_t *desc,
+                                                            size_t size) {
+    uint64_t fingerprint = hid_descriptor_fingerprint(desc, size);
+    size_t home = fingerprint & (HID_LAYOUT_CACHE_SIZE - 1);
+    size_t slot = home;
+
+    // Linear probing, a full cache evicts the home slot of the new descriptor
+    for (size_t n = 0; n < HID_LAYOUT_CACHE_SIZE; ++n) {
+        size_t probe = (home + n) & (HID_LAYOUT_CACHE_SIZE - 1);
+        if (!cache->used[probe]) {
+            slot = probe;
+            break;
+        }
+        if (cache->layouts[probe].fingerprint == fingerprint)
+            return &cache->layouts[probe];
+    }
+
+    // A malformed descriptor must not evict anything, or clear the slot and
+    // break the probe chain of the layouts cached after it
+    struct hid_layout layout;
+    if (hid_parse_layout(desc, size, &layout) < 0)
+        return NULL;
+    cache->layouts[slot] = layout;
+    cache->used[slot] = true;
+    return &cache->layouts[slot];
+}
+
+#endif /* _HID_DESCRIPTOR_H */
@@ -0,0 +1,139 @@
+// Prints the layout hid-descriptor.h builds from report descriptors and
+// measures how fast they are parsed.
+//
+// Build: gcc -O2 -Wall hid-layout.c -o hid-layout
+//
+// Usage: ./hid-layout [-n iterations] <descriptor>...
+//
+// Descriptors are read in the commented hex format of investigation/int0..2.
+// With -n every descriptor is parsed that many times, once without and once
+// with the layout cache, and the throughput is printed.
+//
+// Example: ./hid-layout -n 1000000 ../investigation/int*
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hid-descriptor.h"
+
+// Large enough for any descriptor the kernel accepts (HID_MAX_DESCRIPTOR_SIZE)
+#define MAX_DESCRIPTOR_SIZE 4096
+
+static const char *const kind_names[] = { "Input", "Output", "Feature" };
+
+// Reads the 0xNN bytes of a descriptor, ignoring // comments. Returns the size or -1
+static ssize_t read_descriptor(const char *path, uint8_t *desc, size_t size) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    size_t len = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char *comment = strstr(line, "//");
+        if (comment)
+            *comment = '\0';
+
+        for (char *p = line; (p = strcasestr(p, "0x")); ) {
+            char *end;
+            unsigned long byte = strtoul(p, &end, 16);
+            if (end == p + 2 || byte > 0xFF || len == size) {
+                fprintf(stderr, "%s: bad descriptor byte\n", path);
+                fclose(f);
+                return -1;
+            }
+            desc[len++] = byte;
+            p = end;
+        }
+    }
+    fclose(f);
+    return len;
+}
+
+static void print_layout(const char *path, const struct hid_layout *layout) {
+    printf("%s: fingerprint %016llx, %d top-level collections\n", path,
+           (unsigned long long)layout->fingerprint, layout->collection_count);
+    for (int i = 0; i < layout->collection_count; ++i) {
+        const struct hid_layout_collection *c = &layout->collections[i];
+        printf("  Collection 0x%02X, usage page 0x%04X, usage 0x%04X\n", c->type, c->usage_page, c->usage);
+    }
+    for (int i = 0; i < layout->report_count; ++i) {
+        const struct hid_layout_report *r = &layout->reports[i];
+        printf("  %-7s report %3u: %u bits, %u values\n", kind_names[r->kind], r->id, r->bits, r->values);
+    }
+}
+
+static double elapsed_s(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void benchmark(const char *path, const uint8_t *desc, size_t size, long iterations) {
+    static struct hid_layout layout;
+    static struct hid_layout_cache cache;
+    struct timespec start;
+    long failed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; ++i)
+        failed += hid_parse_layout(desc, size, &layout) < 0;
+    double parse_s = elapsed_s(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; ++i)
+        failed += hid_layout_cache_get(&cache, desc, size) == NULL;
+    double cached_s = elapsed_s(&start);
+
+    printf("%s: parse %.1f ns (%.1f MB/s), cached %.1f ns per descriptor%s\n", path,
+           parse_s / iterations * 1e9, size * iterations / parse_s / 1e6, cached_s / iterations * 1e9,
+           failed ? ", FAILED" : "");
+}
+
+int main(int argc, char **argv) {
+    long iterations = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n': iterations = atol(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations] <descriptor>...\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "Usage: %s [-n iterations] <descriptor>...\n", argv[0]);
+        return 1;
+    }
+
+    int status = 0;
+    for (int i = optind; i < argc; ++i) {
+        uint8_t desc[MAX_DESCRIPTOR_SIZE];
+        ssize_t size = read_descriptor(argv[i], desc, sizeof(desc));
+        if (size < 0) {
+            status = 1;
+            continue;
+        }
+
+        struct hid_layout layout;
+        int ret = hid_parse_layout(desc, size, &layout);
+        if (ret < 0) {
+            fprintf(stderr, "%s: malformed descriptor (%s)\n", argv[i], strerror(-ret));
+            status = 1;
+            continue;
+        }
+
+        if (iterations > 0)
+            benchmark(argv[i], desc, size, iterations);
+        else
+            print_layout(argv[i], &layout);
+    }
+    return status;
+}
@@ -12,83 +12,47 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/hid.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
-#define TARGET_VENDOR  0x3554
-#define TARGET_PRODUCT 0xfffff58a
-
-// Utility for parsing HID report descriptors
-#define ITEM_TYPE_MAIN     0x00
-#define ITEM_TYPE_GLOBAL   0x01
-#define ITEM_TYPE_LOCAL    0x02
-
-#define TAG_USAGE_PAGE     0x00
-#define TAG_USAGE          0x00
-#define TAG_COLLECTION     0x0A
-#define TAG_END_COLLECTION 0x0C
-
-// Utility function that parses and prints the collection info from a HID report descriptor
-int parse_hid_descriptor(const uint8_t *desc, size_t size) {
-    uint16_t usage_page = 0;
-    uint16_t usage = 0;
-    int collection_depth = 0;
-    int top_level_collections = 0;
-
-    size_t i = 0;
-    while (i < size) {
-        uint8_t prefix = desc[i];
-        uint8_t size_code = prefix & 0x03;
-        uint8_t type = (prefix >> 2) & 0x03;
-        uint8_t tag  = (prefix >> 4) & 0x0F;
-
-        size_t data_len;
-        switch (size_code) {
-            case 0: data_len = 0; break;
-            case 1: data_len = 1; break;
-            case 2: data_len = 2; break;
-            case 3: data_len = 4; break; // Long format (rare)
-            default: data_len = 0;
-        }
-
-        if (prefix == 0xFE) { // Long item - skip
-            i += 2 + desc[i+1];
-            continue;
-        }
+#include "../module/vxe-protocol.h"
+#include "hid-descriptor.h"
 
-        if (i + 1 + data_len > size) break;
-
-        uint32_t value = 0;
-        for (size_t j = 0; j < data_len; ++j) {
-            value |= desc[i + 1 + j] << (j * 8);
-        }
+#define TARGET_VENDOR  0x3554
+#define TARGET_PRODUCT_WIRELESS 0xf58a
+#define TARGET_PRODUCT_WIRED    0xf58c
+#define TARGET_INTERFACE   1
+#define TARGET_COLLECTIONS 6
 
-        // Handle items
-        if (type == ITEM_TYPE_GLOBAL && tag == TAG_USAGE_PAGE) {
-            usage_page = value;
-        } else if (type == ITEM_TYPE_LOCAL && tag == TAG_USAGE) {
-            usage = value;
-        } else if (type == ITEM_TYPE_MAIN && tag == TAG_COLLECTION) {
-            if (collection_depth == 0) {
-                ++top_level_collections;
-                printf("Top-Level Collection #%d\n", top_level_collections);
-                printf("  Usage Page: 0x%04X\n", usage_page);
-                printf("  Usage:      0x%04X\n", usage);
-                printf("  Type:       0x%02X\n", (uint8_t)value);
-            }
-            ++collection_depth;
-        } else if (type == ITEM_TYPE_MAIN && tag == TAG_END_COLLECTION) {
-            --collection_depth;
-        }
+// Layouts of the descriptors looked at so far, identical mice share one
+static struct hid_layout_cache layout_cache;
 
-        i += 1 + data_len;
-    }
+// Checks if a product ID is the dongle or the mouse plugged in by cable. Takes
+// 16 bits, HIDIOCGRAWINFO returns it as a signed short.
+static bool is_target_product(uint16_t product) {
+    return product == TARGET_PRODUCT_WIRELESS || product == TARGET_PRODUCT_WIRED;
+}
 
-    printf("Total Top-Level Collections: %d\n", top_level_collections);
+// Checks if a report descriptor is the one of the vendor interface: it has
+// 6 top-level collections and an output report that can carry vendor commands
+static bool descriptor_matches(const uint8_t *desc, size_t size) {
+    const struct hid_layout *layout = hid_layout_cache_get(&layout_cache, desc, size);
+    if (!layout || layout->collection_count != TARGET_COLLECTIONS)
+        return false;
 
-    return top_level_collections;
+    const struct hid_layout_report *output = hid_layout_report(layout, HID_REPORT_OUTPUT, VXE_REPORT_ID);
+    return output && vxe_output_report_valid(output->id, output->values);
 }
 
 // Checks if the report descriptor of the device matches the expected format
-// Specifically, it checks if the number of top-level collections is 6.
 bool report_descriptor_matches(int fd) {
     int desc_size;
     if (ioctl(fd, HIDIOCGRDESCSIZE, &desc_size) < 0) {
@@ -103,12 +67,13 @@ bool report_descriptor_matches(int fd) {
         return false;
     }
 
-    return parse_hid_descriptor(rpt_desc.value, rpt_desc.size) == 6; // Check if collections.length === 6
+    return descriptor_matches(rpt_desc.value, rpt_desc.size);
 }
 
-// Finds a hidraw device that matches the target vendor and product IDs
-// and has a report descriptor with 6 collections.
-void find_hidraw_device(char *found_device_path) {
+// Scans /dev and opens every hidraw node to find the device. Only used when
+// sysfs is not available, since it needs access to every HID device and
+// wakes them all up from autosuspend.
+void scan_dev_hidraw(char *found_device_path, size_t size) {
     DIR *dir;
     struct dirent *entry;
 
@@ -120,7 +85,7 @@ void find_hidraw_device(char *found_device_path) {
 
     while ((entry = readdir(dir)) != NULL) {
         if (strncmp(entry->d_name, "hidraw", 6) == 0) {
-            char path[64];
+            char path[PATH_MAX];
             snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
 
             int fd = open(path, O_RDWR | O_NONBLOCK);
@@ -130,8 +95,8 @@ void find_hidraw_device(char *found_device_path) {
             memset(&info, 0, sizeof(info));
 
             if (ioctl(fd, HIDIOCGRAWINFO, &info) == 0) {
-                if (info.vendor == TARGET_VENDOR && info.product == TARGET_PRODUCT && report_descriptor_matches(fd)) {
-                    strcpy(found_device_path, path);
+                if (info.vendor == TARGET_VENDOR && is_target_product(info.product) && report_descriptor_matches(fd)) {
+                    snprintf(found_device_path, size, "%s", path);
                     close(fd);
                     break;
                 }
@@ -143,9 +108,467 @@ void find_hidraw_device(char *found_device_path) {
     closedir(dir);
 }
 
-int main() {
-    char device_path[64] = {0};
-    find_hidraw_device(device_path);
+// Returns the value of an environment variable or the fallback if unset.
+// The overrides allow pointing the discovery at a fake tree, see bench-discovery.sh
+static const char *env_or(const char *name, const char *fallback) {
+    const char *value = getenv(name);
+    return value && *value ? value : fallback;
+}
+
+// Reads at most size bytes of a sysfs attribute, returns the number of bytes read or -1
+static ssize_t read_attribute(const char *path, void *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    ssize_t total = 0;
+    while ((size_t)total < size) {
+        ssize_t res = read(fd, (uint8_t *)buf + total, size - total);
+        if (res <= 0) break;
+        total += res;
+    }
+    close(fd);
+    return total;
+}
+
+// Reads the vendor and product ID of a hidraw node from the uevent of its HID device,
+// which contains a line like HID_ID=0003:00003554:0000F58A
+static bool sysfs_read_ids(const char *node_dir, uint32_t *vendor, uint32_t *product) {
+    char path[PATH_MAX];
+    char uevent[1024];
+    snprintf(path, sizeof(path), "%s/device/uevent", node_dir);
+
+    ssize_t len = read_attribute(path, uevent, sizeof(uevent) - 1);
+    if (len < 0) return false;
+    uevent[len] = '\0';
+
+    char *line = strstr(uevent, "HID_ID=");
+    unsigned int bus;
+    return line && sscanf(line, "HID_ID=%x:%x:%x", &bus, vendor, product) == 3;
+}
+
+// Returns the USB interface number of a hidraw node, or -1 for devices
+// that are not on USB (e.g. uhid)
+static int sysfs_interface_number(const char *node_dir) {
+    char path[PATH_MAX];
+    char value[8] = {0};
+    snprintf(path, sizeof(path), "%s/device/../bInterfaceNumber", node_dir);
+
+    unsigned int ifnum;
+    if (read_attribute(path, value, sizeof(value) - 1) <= 0 || sscanf(value, "%x", &ifnum) != 1)
+        return -1;
+    return ifnum;
+}
+
+// Reads the report descriptor of a hidraw node without opening the device
+static ssize_t sysfs_report_descriptor(const char *node_dir, uint8_t *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/device/report_descriptor", node_dir);
+    return read_attribute(path, buf, size);
+}
+
+// Checks if a hidraw node in sysfs belongs to the target device. Only the
+// report descriptor of nodes with the right IDs and interface is looked at.
+// If expected_hash is not 0, the descriptor must hash to it instead of being parsed.
+static bool sysfs_node_matches(const char *node_dir, uint64_t expected_hash, uint64_t *hash) {
+    uint32_t vendor, product;
+    if (!sysfs_read_ids(node_dir, &vendor, &product) || vendor != TARGET_VENDOR || product > 0xffff ||
+        !is_target_product(product))
+        return false;
+
+    int ifnum = sysfs_interface_number(node_dir);
+    if (ifnum >= 0 && ifnum != TARGET_INTERFACE)
+        return false;
+
+    uint8_t desc[HID_MAX_DESCRIPTOR_SIZE];
+    ssize_t size = sysfs_report_descriptor(node_dir, desc, sizeof(desc));
+    if (size <= 0)
+        return false;
+
+    *hash = hid_descriptor_fingerprint(desc, size);
+    if (expected_hash)
+        return *hash == expected_hash;
+    return descriptor_matches(desc, size);
+}
+
+// Returns the path of the discovery cache file
+static void cache_path(char *path, size_t size) {
+    const char *file = getenv("VXE_HIDRAW_CACHE");
+    if (file && *file) {
+        snprintf(path, size, "%s", file);
+        return;
+    }
+
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg)
+        snprintf(path, size, "%s/vxe-hidraw", xdg);
+    else
+        snprintf(path, size, "%s/.cache/vxe-hidraw", env_or("HOME", "/tmp"));
+}
+
+// Loads the descriptor hash and hidraw node name found by the last run
+static bool cache_load(uint64_t *hash, char *node, size_t size) {
+    char path[PATH_MAX];
+    cache_path(path, sizeof(path));
+
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+
+    char name[NAME_MAX + 1];
+    bool ok = fscanf(f, "%" SCNx64 " %255s", hash, name) == 2 && *hash != 0;
+    fclose(f);
+
+    if (ok) snprintf(node, size, "%s", name);
+    return ok;
+}
+
+// Stores the descriptor hash and node name, failures only cost a full scan next time
+static void cache_store(uint64_t hash, const char *node) {
+    char path[PATH_MAX];
+    cache_path(path, sizeof(path));
+
+    FILE *f = fopen(path, "w");
+    if (!f) return;
+    fprintf(f, "%016" PRIx64 " %s\n", hash, node);
+    fclose(f);
+}
+
+// Finds a hidraw device that matches the target vendor and product IDs, is
+// the vendor interface and has the vendor interface's report descriptor.
+// Candidates are picked from sysfs, so no device is opened during discovery.
+// The node found last time is checked first and the result is cached across
+// runs keyed by the hash of its report descriptor.
+void find_hidraw_device(char *found_device_path, size_t size) {
+    const char *class_dir = env_or("VXE_HIDRAW_SYSFS", "/sys/class/hidraw");
+    const char *dev_dir = env_or("VXE_HIDRAW_DEV", "/dev");
+    char node_dir[PATH_MAX];
+    uint64_t hash;
+
+    // Hidraw node numbers change when devices are replugged, so a cached
+    // node is only used if its descriptor still has the same hash
+    uint64_t cached_hash;
+    char cached_node[NAME_MAX + 1];
+    if (cache_load(&cached_hash, cached_node, sizeof(cached_node))) {
+        snprintf(node_dir, sizeof(node_dir), "%s/%s", class_dir, cached_node);
+        if (sysfs_node_matches(node_dir, cached_hash, &hash)) {
+            snprintf(found_device_path, size, "%s/%s", dev_dir, cached_node);
+            return;
+        }
+    }
+
+    DIR *dir = opendir(class_dir);
+    if (!dir) {
+        fprintf(stderr, "Cannot read %s, opening every hidraw node instead\n", class_dir);
+        scan_dev_hidraw(found_device_path, size);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "hidraw", 6) != 0)
+            continue;
+
+        snprintf(node_dir, sizeof(node_dir), "%s/%s", class_dir, entry->d_name);
+        if (sysfs_node_matches(node_dir, 0, &hash)) {
+            snprintf(found_device_path, size, "%s/%s", dev_dir, entry->d_name);
+            cache_store(hash, entry->d_name);
+            break;
+        }
+    }
+
+    closedir(dir);
+}
+
+// Battery query, built once from the shared protocol definitions
+static uint8_t battery_request[VXE_REPORT_SIZE];
+
+// Daemon mode, see run_daemon
+#define MAX_MICE           16
+#define QUERY_INTERVAL_S   60
+#define REQUEST_TIMEOUT_MS 1000
+
+// Sources in the daemon's epoll set, mice use their slot index
+#define SOURCE_QUERY   (MAX_MICE + 0)
+#define SOURCE_TIMEOUT (MAX_MICE + 1)
+#define SOURCE_HOTPLUG (MAX_MICE + 2)
+#define SOURCE_SIGNAL  (MAX_MICE + 3)
+
+struct hidraw_mouse {
+    int fd;                  // -1 if the slot is free
+    char node[NAME_MAX + 1]; // e.g. hidraw3
+    bool pending;            // A battery query is waiting for its response
+    struct timespec sent;
+    struct timespec deadline;
+    unsigned long timeouts;
+};
+
+static struct hidraw_mouse mice[MAX_MICE];
+static int epoll_fd = -1;
+static int timeout_timer = -1;
+
+static long long timespec_ms(const struct timespec *ts) {
+    return ts->tv_sec * 1000LL + ts->tv_nsec / 1000000;
+}
+
+static void epoll_watch(int fd, uint64_t source) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = source };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Arms the timeout timer for the earliest deadline of all pending queries
+static void arm_timeout(void) {
+    struct itimerspec spec = {0};
+
+    for (int i = 0; i < MAX_MICE; i++) {
+        if (mice[i].fd < 0 || !mice[i].pending)
+            continue;
+        if ((spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) ||
+            timespec_ms(&mice[i].deadline) < timespec_ms(&spec.it_value))
+            spec.it_value = mice[i].deadline;
+    }
+
+    timerfd_settime(timeout_timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void send_query(struct hidraw_mouse *mouse) {
+    if (write(mouse->fd, battery_request, sizeof(battery_request)) < 0) {
+        fprintf(stderr, "%s: write: %s\n", mouse->node, strerror(errno));
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &mouse->sent);
+    mouse->deadline = mouse->sent;
+    mouse->deadline.tv_nsec += (REQUEST_TIMEOUT_MS % 1000) * 1000000L;
+    mouse->deadline.tv_sec += REQUEST_TIMEOUT_MS / 1000 + mouse->deadline.tv_nsec / 1000000000L;
+    mouse->deadline.tv_nsec %= 1000000000L;
+    mouse->pending = true;
+}
+
+static struct hidraw_mouse *find_mouse(const char *node) {
+    for (int i = 0; i < MAX_MICE; i++) {
+        if (mice[i].fd >= 0 && strcmp(mice[i].node, node) == 0)
+            return &mice[i];
+    }
+    return NULL;
+}
+
+// Starts monitoring a hidraw node if it is a VXE battery interface
+static void add_mouse(const char *node) {
+    const char *class_dir = env_or("VXE_HIDRAW_SYSFS", "/sys/class/hidraw");
+    const char *dev_dir = env_or("VXE_HIDRAW_DEV", "/dev");
+    char path[PATH_MAX];
+    uint64_t hash;
+
+    if (find_mouse(node))
+        return;
+
+    snprintf(path, sizeof(path), "%s/%s", class_dir, node);
+    if (!sysfs_node_matches(path, 0, &hash))
+        return;
+
+    int slot = 0;
+    while (slot < MAX_MICE && mice[slot].fd >= 0)
+        slot++;
+    if (slot == MAX_MICE) {
+        fprintf(stderr, "%s: too many mice, ignoring\n", node);
+        return;
+    }
+
+    // udev may not have applied the permissions yet, the IN_ATTRIB event retries
+    snprintf(path, sizeof(path), "%s/%s", dev_dir, node);
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    struct hidraw_mouse *mouse = &mice[slot];
+    memset(mouse, 0, sizeof(*mouse));
+    mouse->fd = fd;
+    snprintf(mouse->node, sizeof(mouse->node), "%s", node);
+    epoll_watch(fd, slot);
+    printf("%s: monitoring\n", node);
+
+    // Query a new mouse right away instead of waiting for the next interval
+    send_query(mouse);
+    arm_timeout();
+}
+
+static void remove_mouse(struct hidraw_mouse *mouse) {
+    printf("%s: removed\n", mouse->node);
+    close(mouse->fd); // Also removes it from the epoll set
+    mouse->fd = -1;
+    arm_timeout();
+}
+
+static void handle_report(struct hidraw_mouse *mouse) {
+    uint8_t buf[64];
+    ssize_t res = read(mouse->fd, buf, sizeof(buf));
+    if (res < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            remove_mouse(mouse);
+        return;
+    }
+
+    // Responses are matched by report ID and command byte
+    struct vxe_battery_info info;
+    if (!mouse->pending || vxe_parse_battery(buf, res, &info) != 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    mouse->pending = false;
+    arm_timeout();
+
+    printf("%s: %u%% %s %u mV (%lld ms)\n", mouse->node, info.level,
+           vxe_battery_charging(&info) ? "charging" : "discharging", info.voltage_mv,
+           timespec_ms(&now) - timespec_ms(&mouse->sent));
+}
+
+static void handle_timeouts(void) {
+    uint64_t expirations;
+    struct timespec now;
+
+    if (read(timeout_timer, &expirations, sizeof(expirations)) < 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < MAX_MICE; i++) {
+        struct hidraw_mouse *mouse = &mice[i];
+        if (mouse->fd < 0 || !mouse->pending || timespec_ms(&mouse->deadline) > timespec_ms(&now))
+            continue;
+        mouse->pending = false;
+        mouse->timeouts++;
+        fprintf(stderr, "%s: no response within %d ms (%lu timeouts)\n", mouse->node,
+                REQUEST_TIMEOUT_MS, mouse->timeouts);
+    }
+    arm_timeout();
+}
+
+static void handle_hotplug(int inotify_fd) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(inotify_fd, buf, sizeof(buf));
+
+    for (char *p = buf; len > 0 && p < buf + len;) {
+        struct inotify_event *event = (struct inotify_event *)p;
+        p += sizeof(*event) + event->len;
+
+        if (event->len == 0 || strncmp(event->name, "hidraw", 6) != 0)
+            continue;
+
+        if (event->mask & IN_DELETE) {
+            struct hidraw_mouse *mouse = find_mouse(event->name);
+            if (mouse)
+                remove_mouse(mouse);
+        } else {
+            add_mouse(event->name);
+        }
+    }
+}
+
+// Monitors every VXE mouse on the machine from a single epoll loop. All mice
+// are queried every interval_s seconds, new hidraw nodes are picked up through
+// inotify on /dev. Nothing runs between queries.
+static int run_daemon(int interval_s) {
+    for (int i = 0; i < MAX_MICE; i++)
+        mice[i].fd = -1;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        perror("signalfd");
+        return 1;
+    }
+    epoll_watch(signal_fd, SOURCE_SIGNAL);
+
+    // Watch for hotplug before the initial scan so no node is missed
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, env_or("VXE_HIDRAW_DEV", "/dev"),
+                                            IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+        perror("inotify");
+        return 1;
+    }
+    epoll_watch(inotify_fd, SOURCE_HOTPLUG);
+
+    int query_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    timeout_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (query_timer < 0 || timeout_timer < 0) {
+        perror("timerfd_create");
+        return 1;
+    }
+    struct itimerspec interval = { .it_value = { interval_s, 0 }, .it_interval = { interval_s, 0 } };
+    timerfd_settime(query_timer, 0, &interval, NULL);
+    epoll_watch(query_timer, SOURCE_QUERY);
+    epoll_watch(timeout_timer, SOURCE_TIMEOUT);
+
+    DIR *dir = opendir(env_or("VXE_HIDRAW_SYSFS", "/sys/class/hidraw"));
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "hidraw", 6) == 0)
+                add_mouse(entry->d_name);
+        }
+        closedir(dir);
+    }
+
+    struct epoll_event events[MAX_MICE + 4];
+    for (;;) {
+        int n = epoll_wait(epoll_fd, events, MAX_MICE + 4, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint64_t source = events[i].data.u64;
+            uint64_t expirations;
+
+            if (source < MAX_MICE) {
+                // The mouse may have been removed earlier in this batch
+                if (mice[source].fd >= 0)
+                    handle_report(&mice[source]);
+            } else if (source == SOURCE_QUERY) {
+                if (read(query_timer, &expirations, sizeof(expirations)) < 0)
+                    continue;
+                for (int j = 0; j < MAX_MICE; j++) {
+                    if (mice[j].fd >= 0)
+                        send_query(&mice[j]);
+                }
+                arm_timeout();
+            } else if (source == SOURCE_TIMEOUT) {
+                handle_timeouts();
+            } else if (source == SOURCE_HOTPLUG) {
+                handle_hotplug(inotify_fd);
+            } else if (source == SOURCE_SIGNAL) {
+                return 0;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    vxe_build_command(battery_request, VXE_CMD_BATTERY);
+
+    // Long running mode for every mouse on the machine, optionally with the query interval in seconds
+    if (argc > 1 && strcmp(argv[1], "--daemon") == 0) {
+        int interval_s = argc > 2 ? atoi(argv[2]) : QUERY_INTERVAL_S;
+        return run_daemon(interval_s > 0 ? interval_s : QUERY_INTERVAL_S);
+    }
+
+    char device_path[PATH_MAX] = {0};
+    find_hidraw_device(device_path, sizeof(device_path));
 
     if (strlen(device_path) == 0) {
         fprintf(stderr, "Target HID device not found\n");
@@ -153,20 +576,17 @@ int main() {
     }
     printf("Found HID device at: %s\n", device_path);
 
+    // Discovery only, used by bench-discovery.sh
+    if (argc > 1 && strcmp(argv[1], "--find") == 0)
+        return 0;
+
     int fd = open(device_path, O_RDWR | O_NONBLOCK);
     if (fd < 0) {
         perror("open");
         return 1;
     }
 
-    unsigned char report[] = {
-        0x08, // Report ID
-        0x04, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x49
-    };
-    ssize_t res = write(fd, report, sizeof(report));
+    ssize_t res = write(fd, battery_request, sizeof(battery_request));
     if (res < 0) {
         perror("write");
         close(fd);
@@ -175,8 +595,17 @@ int main() {
     printf("Report sent successfully (%ld bytes)\n", res);
 
 
+    // Wait for the response instead of polling for it
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
     unsigned char buf[64];
     while (1) {
+        int ready = poll(&pfd, 1, REQUEST_TIMEOUT_MS);
+        if (ready == 0) {
+            fprintf(stderr, "No response within %d ms\n", REQUEST_TIMEOUT_MS);
+            close(fd);
+            return 1;
+        }
+
         res = read(fd, buf, sizeof(buf));
         if (res > 0) {
             printf("Received input report (%ld bytes):\n", res);
@@ -184,10 +613,10 @@ int main() {
                 printf("%02hhx ", buf[i]);
             printf("\n");
             break; // Exit after first successful read
-        } else {
-            if (errno != EAGAIN && errno != EWOULDBLOCK)
-                perror("read");
-            usleep(100000); // 100ms delay
+        } else if (ready < 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            perror("read");
+            close(fd);
+            return 1;
         }
     }
 
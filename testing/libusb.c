@@ -1,15 +1,286 @@
 #include <stdio.h>
 #include <libusb.h>
 #include <unistd.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../module/vxe-protocol.h"
 
 #define VENDOR_ID  0x3554
 #define PRODUCT_ID 0xf58a
 #define INTERFACE  1
 #define ENDPOINT_IN  0x82  // Interrupt IN endpoint for interface 1
-#define REPORT_ID  0x08
+#define REPORT_ID  VXE_REPORT_ID
 #define REPORT_TYPE_OUTPUT 0x02
+#define REPORT_SIZE VXE_REPORT_SIZE
+#define TIMEOUT_MS 1000
+#define MAX_DONGLES 16
+
+// One dongle handled by the async event loop
+struct dongle {
+    libusb_device *dev;
+    libusb_device_handle *handle;
+    struct libusb_transfer *in;  // Interrupt IN transfer, kept in flight
+    struct libusb_transfer *out; // SET_REPORT control transfer
+    unsigned char in_buf[64];
+    unsigned char out_buf[LIBUSB_CONTROL_SETUP_SIZE + REPORT_SIZE];
+    bool detached;     // The kernel driver has to be reattached on close
+    bool waiting;      // The battery response has not arrived yet
+    bool left;         // Unplugged, noticed by the hotplug callback
+    bool gone;         // Closing, transfers are not resubmitted
+    struct timespec sent;
+};
+
+static struct dongle *dongles[MAX_DONGLES];
+// Devices that arrived in the hotplug callback, opened from the event loop
+static libusb_device *arrived[MAX_DONGLES];
+static int arrived_count;
+static bool watch;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void dongle_free(struct dongle *d) {
+    for (int i = 0; i < MAX_DONGLES; i++) {
+        if (dongles[i] == d)
+            dongles[i] = NULL;
+    }
+
+    libusb_free_transfer(d->in);
+    libusb_free_transfer(d->out);
+    libusb_release_interface(d->handle, INTERFACE);
+    if (d->detached)
+        libusb_attach_kernel_driver(d->handle, INTERFACE);
+    libusb_close(d->handle);
+    libusb_unref_device(d->dev);
+    free(d);
+}
+
+// Frees the dongle once neither of its transfers is in flight anymore
+static void dongle_maybe_free(struct dongle *d) {
+    if (d->gone && !d->in->user_data && !d->out->user_data)
+        dongle_free(d);
+}
+
+// The transfers' user_data doubles as the in flight flag
+static void LIBUSB_CALL out_cb(struct libusb_transfer *transfer) {
+    struct dongle *d = transfer->user_data;
+    transfer->user_data = NULL;
+
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        fprintf(stderr, "SET_REPORT failed with transfer status %d\n", transfer->status);
+        d->waiting = false;
+    }
+    dongle_maybe_free(d);
+}
+
+static void LIBUSB_CALL in_cb(struct libusb_transfer *transfer) {
+    struct dongle *d = transfer->user_data;
+    transfer->user_data = NULL;
+
+    // Responses are matched by report ID and command, other reports are ignored
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED && d->waiting &&
+        vxe_report_command(d->in_buf, transfer->actual_length) == VXE_CMD_BATTERY) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long us = (now.tv_sec - d->sent.tv_sec) * 1000000LL + (now.tv_nsec - d->sent.tv_nsec) / 1000;
+
+        printf("Received %d bytes from device %d-%d after %lld us:\n", transfer->actual_length,
+               libusb_get_bus_number(d->dev), libusb_get_device_address(d->dev), us);
+        for (int i = 0; i < transfer->actual_length; i++) {
+            printf("%02x ", d->in_buf[i]);
+        }
+        printf("\n");
+        d->waiting = false;
+    }
+
+    // Only a completed or timed out read is worth resubmitting, anything else
+    // (stall, overflow, unplug, cancellation) ends the dongle
+    if (transfer->status != LIBUSB_TRANSFER_COMPLETED && transfer->status != LIBUSB_TRANSFER_TIMED_OUT &&
+        !d->gone) {
+        if (transfer->status != LIBUSB_TRANSFER_NO_DEVICE)
+            fprintf(stderr, "Interrupt read from device %d-%d failed with transfer status %d\n",
+                    libusb_get_bus_number(d->dev), libusb_get_device_address(d->dev), transfer->status);
+        d->gone = true;
+        d->waiting = false;
+        if (d->out->user_data)
+            libusb_cancel_transfer(d->out);
+    }
+
+    if (!d->gone && libusb_submit_transfer(transfer) == 0)
+        transfer->user_data = d;
+    else
+        dongle_maybe_free(d);
+}
+
+static void dongle_open(libusb_device *dev) {
+    int slot = 0;
+    while (slot < MAX_DONGLES && dongles[slot])
+        slot++;
+    if (slot == MAX_DONGLES) {
+        fprintf(stderr, "Too many dongles\n");
+        return;
+    }
+
+    struct dongle *d = calloc(1, sizeof(*d));
+    if (!d)
+        return;
+
+    int r = libusb_open(dev, &d->handle);
+    if (r != 0) {
+        fprintf(stderr, "Cannot open device: %s\n", libusb_error_name(r));
+        free(d);
+        return;
+    }
+    d->dev = libusb_ref_device(dev);
+
+    if (libusb_kernel_driver_active(d->handle, INTERFACE) == 1)
+        d->detached = libusb_detach_kernel_driver(d->handle, INTERFACE) == 0;
+
+    d->in = libusb_alloc_transfer(0);
+    d->out = libusb_alloc_transfer(0);
+    if (!d->in || !d->out) {
+        fprintf(stderr, "Cannot allocate transfers\n");
+        dongle_free(d);
+        return;
+    }
+    if ((r = libusb_claim_interface(d->handle, INTERFACE)) != 0) {
+        fprintf(stderr, "Failed to claim interface: %s\n", libusb_error_name(r));
+        dongle_free(d);
+        return;
+    }
+    dongles[slot] = d;
+
+    // The IN transfer goes first so the response can't arrive before anyone listens
+    libusb_fill_interrupt_transfer(d->in, d->handle, ENDPOINT_IN, d->in_buf, sizeof(d->in_buf),
+                                   in_cb, NULL, 0);
+    if ((r = libusb_submit_transfer(d->in)) != 0) {
+        fprintf(stderr, "Interrupt read failed: %s\n", libusb_error_name(r));
+        d->gone = true;
+        dongle_maybe_free(d);
+        return;
+    }
+    d->in->user_data = d;
+
+    libusb_fill_control_setup(d->out_buf, 0x21, 0x09, (REPORT_TYPE_OUTPUT << 8) | REPORT_ID,
+                              INTERFACE, REPORT_SIZE);
+    vxe_build_command(d->out_buf + LIBUSB_CONTROL_SETUP_SIZE, VXE_CMD_BATTERY);
+    libusb_fill_control_transfer(d->out, d->handle, d->out_buf, out_cb, NULL, TIMEOUT_MS);
+    clock_gettime(CLOCK_MONOTONIC, &d->sent);
+    if ((r = libusb_submit_transfer(d->out)) != 0) {
+        fprintf(stderr, "Control transfer failed: %s\n", libusb_error_name(r));
+        return;
+    }
+    d->out->user_data = d;
+    d->waiting = true;
+}
+
+// Stops a dongle, it is freed once its transfers have been cancelled
+static void dongle_close(struct dongle *d) {
+    if (d->gone)
+        return;
+    d->gone = true;
+    d->waiting = false;
+    if (d->in->user_data)
+        libusb_cancel_transfer(d->in);
+    if (d->out->user_data)
+        libusb_cancel_transfer(d->out);
+    dongle_maybe_free(d);
+}
 
-int main(void) {
+// Only records events, libusb must not be called back into from here
+static int LIBUSB_CALL hotplug_cb(libusb_context *ctx, libusb_device *dev,
+                                  libusb_hotplug_event event, void *user_data) {
+    (void)ctx;
+    (void)user_data;
+
+    if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        if (arrived_count < MAX_DONGLES)
+            arrived[arrived_count++] = libusb_ref_device(dev);
+    } else {
+        for (int i = 0; i < MAX_DONGLES; i++) {
+            if (dongles[i] && dongles[i]->dev == dev)
+                dongles[i]->left = true;
+        }
+    }
+    return 0;
+}
+
+// Queries every dongle through asynchronous transfers from a single event
+// loop. Each dongle finishes as soon as its response arrives or gives up
+// after TIMEOUT_MS. With watch set, it keeps running and queries dongles as
+// they are plugged in.
+static int run_async(libusb_context *ctx) {
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        fprintf(stderr, "libusb has no hotplug support\n");
+        return 1;
+    }
+
+    libusb_hotplug_callback_handle hotplug;
+    int r = libusb_hotplug_register_callback(ctx,
+        LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+        LIBUSB_HOTPLUG_ENUMERATE, VENDOR_ID, PRODUCT_ID, LIBUSB_HOTPLUG_MATCH_ANY,
+        hotplug_cb, NULL, &hotplug);
+    if (r != LIBUSB_SUCCESS) {
+        fprintf(stderr, "Hotplug registration failed: %s\n", libusb_error_name(r));
+        return 1;
+    }
+
+    for (;;) {
+        for (int i = 0; i < arrived_count; i++) {
+            dongle_open(arrived[i]);
+            libusb_unref_device(arrived[i]);
+        }
+        arrived_count = 0;
+
+        // Sleep until the earliest response deadline, or until an event arrives
+        long long deadline = -1;
+        bool any = false;
+        for (int i = 0; i < MAX_DONGLES; i++) {
+            struct dongle *d = dongles[i];
+            if (!d)
+                continue;
+
+            long long due = d->sent.tv_sec * 1000LL + d->sent.tv_nsec / 1000000 + TIMEOUT_MS;
+            if (d->waiting && due <= now_ms()) {
+                fprintf(stderr, "No response from device %d-%d within %d ms\n",
+                        libusb_get_bus_number(d->dev), libusb_get_device_address(d->dev), TIMEOUT_MS);
+                d->waiting = false;
+            }
+
+            // Cancelled transfers complete through the event loop, which frees the dongle
+            if (d->left || (!d->waiting && !watch))
+                dongle_close(d);
+            else if (d->waiting && (deadline < 0 || due < deadline))
+                deadline = due;
+        }
+
+        for (int i = 0; i < MAX_DONGLES; i++)
+            any |= dongles[i] != NULL;
+        if (!any && !watch)
+            break;
+
+        if (deadline >= 0) {
+            long long wait = deadline - now_ms();
+            if (wait < 0)
+                wait = 0;
+            struct timeval tv = { wait / 1000, (wait % 1000) * 1000 };
+            libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+        } else {
+            libusb_handle_events_completed(ctx, NULL);
+        }
+    }
+
+    libusb_hotplug_deregister_callback(ctx, hotplug);
+    return 0;
+}
+
+int main(int argc, char **argv) {
     libusb_device_handle *handle;
     libusb_context *ctx = NULL;
     int r;
@@ -20,6 +291,14 @@ int main(void) {
         return 1;
     }
 
+    // --async queries every dongle once, --watch keeps handling hotplugged dongles
+    if (argc > 1 && (strcmp(argv[1], "--async") == 0 || strcmp(argv[1], "--watch") == 0)) {
+        watch = strcmp(argv[1], "--watch") == 0;
+        r = run_async(ctx);
+        libusb_exit(ctx);
+        return r;
+    }
+
     handle = libusb_open_device_with_vid_pid(ctx, VENDOR_ID, PRODUCT_ID);
     if (!handle) {
         fprintf(stderr, "Cannot open device\n");
@@ -39,11 +318,8 @@ int main(void) {
         return 1;
     }
 
-    unsigned char data[17] = {
-        0x08, 0x04, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x49
-    };
+    unsigned char data[REPORT_SIZE];
+    vxe_build_command(data, VXE_CMD_BATTERY);
 
     // SET_REPORT (HID) via control transfer
     uint8_t bmRequestType = 0x21;  // Host to device | Class | Interface
@@ -62,7 +338,7 @@ int main(void) {
     usleep(10000);  // 10ms
 
     // Read interrupt IN data
-    unsigned char in_data[17];
+    unsigned char in_data[REPORT_SIZE];
     int transferred = 0;
     r = libusb_interrupt_transfer(handle, ENDPOINT_IN, in_data, sizeof(in_data), &transferred, 1000);
     if (r == 0 && transferred > 0) {
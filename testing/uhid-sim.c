@@ -0,0 +1,685 @@
+// Virtual VXE Dragonfly R1 Pro Max simulator built on /dev/uhid.
+//
+// Creates any number of virtual mice, each made of the same three HID
+// interfaces as the real dongle (or wired mouse), using the report descriptors
+// captured in investigation/int0, int1 and int2. The vendor interface answers
+// battery queries like the mouse does and the mouse interface produces motion
+// at the polling rate, so hid-vxe-r1 can be loaded against many devices
+// without any hardware.
+//
+// Build: gcc -O2 -Wall uhid-sim.c -o uhid-sim -lm
+//
+// Examples (needs access to /dev/uhid):
+//   ./uhid-sim -n 50 -t 600                 50 dongles for 10 minutes
+//   ./uhid-sim -n 8 -d 20 -j 10 -l 5        20-30 ms response delay, 5% dropped responses
+//   ./uhid-sim -n 16 -r 0 -C 50             no motion, plug/unplug a mouse every 50 ms
+//
+// On exit the simulator prints its own CPU time and what the kernel did
+// meanwhile: system, IRQ and softirq time of all CPUs minus the simulator's own
+// system time, context switches, the growth of slab memory since before the
+// mice were created, and the requests the driver counted in its vxe_battery
+// debugfs files (when debugfs is readable). The kernel numbers are system wide
+// and include HID core, uhid and input, so run it on an otherwise idle machine
+// and compare against a run with the driver unloaded. For a closer look, use
+// e.g. `perf stat -a -e power:cpu_idle`, `/proc/<kworker>/stat` and `slabtop`.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "../module/vxe-protocol.h"
+
+#define VENDOR_ID        0x3554
+#define PRODUCT_WIRELESS 0xf58a
+#define PRODUCT_WIRED    0xf58c
+
+#define INTERFACES       3
+#define MOTION_INTERFACE 0
+#define VENDOR_INTERFACE 1
+
+// Size of a motion report on interface 0: buttons, X, Y, wheel, AC pan
+#define MOTION_REPORT_SIZE 7
+
+// Kinds of file descriptors in the epoll set, packed into the event data
+enum source_kind {
+    SOURCE_UHID,
+    SOURCE_RESPONSE,
+    SOURCE_MOTION,
+    SOURCE_CHURN,
+    SOURCE_DURATION,
+    SOURCE_SIGNAL,
+};
+
+enum battery_curve {
+    CURVE_DISCHARGE,
+    CURVE_CHARGE,
+    CURVE_FLAT,
+};
+
+struct options {
+    int count;              // Number of virtual mice
+    uint16_t product;       // Product ID the mice show up with
+    const char *desc_dir;   // Directory with the captured descriptors
+    int delay_ms;           // Base battery response delay
+    int jitter_ms;          // Random extra response delay
+    double drop_rate;       // Fraction of battery responses that are never sent
+    enum battery_curve curve;
+    double start_level;     // Battery level every mouse starts at
+    double seconds_per_pct; // How fast the battery level moves
+    int motion_hz;          // Motion reports per second per mouse, 0 for none
+    int churn_ms;           // Interval between hotplug events, 0 for none
+    int duration_s;         // Run time, 0 until interrupted
+    bool unique_serials;    // Give every mouse its own serial number
+    bool verbose;
+};
+
+struct descriptor {
+    uint8_t data[HID_MAX_DESCRIPTOR_SIZE];
+    size_t size;
+};
+
+struct sim_mouse {
+    int index;
+    int fds[INTERFACES];    // uhid device per interface, -1 when unplugged
+    int response_timer;     // Fires when the pending battery response is due
+    bool plugged;
+
+    double level;           // Simulated battery level in percent
+    bool charging;
+    struct timespec last_update;
+
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long dropped;
+    unsigned long motion;
+    unsigned long plugs;
+};
+
+static struct options opts = {
+    .count = 1,
+    .product = PRODUCT_WIRELESS,
+    .desc_dir = "../investigation",
+    .delay_ms = 5,
+    .drop_rate = 0.0,
+    .curve = CURVE_DISCHARGE,
+    .start_level = 80.0,
+    .seconds_per_pct = 60.0,
+    .motion_hz = 1000,
+};
+
+static struct descriptor descriptors[INTERFACES];
+static struct sim_mouse *mice;
+static int epoll_fd = -1;
+static int motion_timer = -1;
+static int churn_timer = -1;
+
+static uint64_t pack_source(enum source_kind kind, int mouse, int intf) {
+    return ((uint64_t)kind << 48) | ((uint64_t)(uint32_t)mouse << 8) | (uint8_t)intf;
+}
+
+static void unpack_source(uint64_t data, enum source_kind *kind, int *mouse, int *intf) {
+    *kind = data >> 48;
+    *mouse = (uint32_t)(data >> 8);
+    *intf = data & 0xff;
+}
+
+static void watch_fd(int fd, uint64_t data) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = data };
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static double elapsed_seconds(const struct timespec *since, const struct timespec *now) {
+    return (now->tv_sec - since->tv_sec) + (now->tv_nsec - since->tv_nsec) / 1e9;
+}
+
+// Loads a descriptor from the text format in investigation/,
+// one or more "0xNN," items per line followed by a comment
+static int load_descriptor(const char *path, struct descriptor *desc) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    desc->size = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *comment = strstr(line, "//");
+        if (comment)
+            *comment = '\0';
+
+        char *p = line;
+        unsigned int byte;
+        int consumed;
+        while (sscanf(p, " 0x%2x ,%n", &byte, &consumed) == 1) {
+            if (desc->size >= sizeof(desc->data)) {
+                fprintf(stderr, "%s: descriptor too large\n", path);
+                fclose(f);
+                return -1;
+            }
+            desc->data[desc->size++] = byte;
+            p += consumed;
+        }
+    }
+
+    fclose(f);
+    return desc->size ? 0 : -1;
+}
+
+static void uhid_send(int fd, const struct uhid_event *ev) {
+    if (write(fd, ev, sizeof(*ev)) != sizeof(*ev) && errno != EAGAIN)
+        perror("uhid write");
+}
+
+static void uhid_input(int fd, const uint8_t *data, size_t size) {
+    struct uhid_event ev = { .type = UHID_INPUT2 };
+
+    ev.u.input2.size = size;
+    memcpy(ev.u.input2.data, data, size);
+    uhid_send(fd, &ev);
+}
+
+static void mouse_plug(struct sim_mouse *m) {
+    for (int i = 0; i < INTERFACES; i++) {
+        int fd = open("/dev/uhid", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+        if (fd < 0) {
+            perror("open /dev/uhid");
+            exit(EXIT_FAILURE);
+        }
+
+        struct uhid_event ev = { .type = UHID_CREATE2 };
+        snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "VXE NordicMouse 1K %s",
+                 opts.product == PRODUCT_WIRED ? "Mouse" : "Dongle");
+        snprintf((char *)ev.u.create2.phys, sizeof(ev.u.create2.phys), "vxe-sim/%d/input%d", m->index, i);
+        if (opts.unique_serials)
+            snprintf((char *)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "vxe-sim-%d", m->index);
+        ev.u.create2.bus = BUS_USB;
+        ev.u.create2.vendor = VENDOR_ID;
+        ev.u.create2.product = opts.product;
+        ev.u.create2.version = 0x0110;
+        ev.u.create2.rd_size = descriptors[i].size;
+        memcpy(ev.u.create2.rd_data, descriptors[i].data, descriptors[i].size);
+
+        if (write(fd, &ev, sizeof(ev)) != sizeof(ev)) {
+            perror("UHID_CREATE2");
+            exit(EXIT_FAILURE);
+        }
+
+        m->fds[i] = fd;
+        watch_fd(fd, pack_source(SOURCE_UHID, m->index, i));
+    }
+
+    m->plugged = true;
+    m->plugs++;
+}
+
+static void mouse_unplug(struct sim_mouse *m) {
+    struct itimerspec disarm = { 0 };
+
+    // Closing the uhid fd destroys the device
+    for (int i = 0; i < INTERFACES; i++) {
+        close(m->fds[i]);
+        m->fds[i] = -1;
+    }
+    timerfd_settime(m->response_timer, 0, &disarm, NULL);
+    m->plugged = false;
+}
+
+// Advances the simulated battery to the current time
+static void battery_update(struct sim_mouse *m) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double pct = elapsed_seconds(&m->last_update, &now) / opts.seconds_per_pct;
+    m->last_update = now;
+
+    switch (opts.curve) {
+    case CURVE_DISCHARGE:
+        m->level = fmax(m->level - pct, 0.0);
+        break;
+    case CURVE_CHARGE:
+        m->level = fmin(m->level + pct, 100.0);
+        m->charging = m->level < 100.0;
+        break;
+    case CURVE_FLAT:
+        break;
+    }
+}
+
+static void send_battery_response(struct sim_mouse *m) {
+    uint8_t report[VXE_REPORT_SIZE] = { VXE_REPORT_ID, VXE_CMD_BATTERY };
+
+    battery_update(m);
+
+    // Roughly linear Li-ion curve between 3.3 V and 4.2 V with a few mV of
+    // jitter, like the real mouse reports
+    int voltage = 3300 + (int)(m->level * 9.0) + rand() % 7 - 3;
+
+    report[5] = 0x02;
+    report[VXE_OFF_BATTERY_LEVEL] = (uint8_t)ceil(m->level);
+    report[VXE_OFF_BATTERY_CHARGE] = m->charging ? VXE_CHARGE_CHARGING : VXE_CHARGE_DISCHARGING;
+    report[VXE_OFF_BATTERY_VOLTAGE] = voltage >> 8;
+    report[VXE_OFF_BATTERY_VOLTAGE + 1] = voltage & 0xff;
+
+    report[VXE_OFF_CHECKSUM] = vxe_checksum(report);
+
+    uhid_input(m->fds[VENDOR_INTERFACE], report, sizeof(report));
+    m->responses++;
+}
+
+// Handles a vendor command, either from SET_REPORT or an output report
+static void handle_command(struct sim_mouse *m, const uint8_t *data, size_t size) {
+    if (vxe_report_command(data, size) != VXE_CMD_BATTERY)
+        return;
+
+    m->requests++;
+    if ((double)rand() / RAND_MAX < opts.drop_rate) {
+        m->dropped++;
+        return;
+    }
+
+    int delay_ms = opts.delay_ms + (opts.jitter_ms ? rand() % (opts.jitter_ms + 1) : 0);
+    if (delay_ms == 0) {
+        send_battery_response(m);
+        return;
+    }
+
+    // A newer request replaces a response that is still pending
+    struct itimerspec due = {
+        .it_value.tv_sec = delay_ms / 1000,
+        .it_value.tv_nsec = (delay_ms % 1000) * 1000000L,
+    };
+    timerfd_settime(m->response_timer, 0, &due, NULL);
+}
+
+static void handle_uhid(struct sim_mouse *m, int intf) {
+    struct uhid_event ev;
+    struct uhid_event reply;
+
+    if (read(m->fds[intf], &ev, sizeof(ev)) <= 0)
+        return;
+
+    switch (ev.type) {
+    case UHID_OUTPUT:
+        if (intf == VENDOR_INTERFACE)
+            handle_command(m, ev.u.output.data, ev.u.output.size);
+        break;
+    case UHID_SET_REPORT:
+        // The driver blocks until the reply arrives, answer right away
+        memset(&reply, 0, sizeof(reply));
+        reply.type = UHID_SET_REPORT_REPLY;
+        reply.u.set_report_reply.id = ev.u.set_report.id;
+        uhid_send(m->fds[intf], &reply);
+        if (intf == VENDOR_INTERFACE)
+            handle_command(m, ev.u.set_report.data, ev.u.set_report.size);
+        break;
+    case UHID_GET_REPORT:
+        memset(&reply, 0, sizeof(reply));
+        reply.type = UHID_GET_REPORT_REPLY;
+        reply.u.get_report_reply.id = ev.u.get_report.id;
+        reply.u.get_report_reply.err = EIO;
+        uhid_send(m->fds[intf], &reply);
+        break;
+    default:
+        // UHID_START, UHID_STOP, UHID_OPEN and UHID_CLOSE need no action
+        break;
+    }
+}
+
+static void send_motion(void) {
+    static unsigned int tick;
+    uint8_t report[MOTION_REPORT_SIZE] = { 0 };
+
+    // Move in a small square so the cursor stays where it is
+    int16_t dx = (tick / 250) % 4 == 0 ? 1 : (tick / 250) % 4 == 2 ? -1 : 0;
+    int16_t dy = (tick / 250) % 4 == 1 ? 1 : (tick / 250) % 4 == 3 ? -1 : 0;
+    tick++;
+
+    report[1] = dx & 0xff;
+    report[2] = (uint16_t)dx >> 8;
+    report[3] = dy & 0xff;
+    report[4] = (uint16_t)dy >> 8;
+
+    for (int i = 0; i < opts.count; i++) {
+        if (!mice[i].plugged)
+            continue;
+        uhid_input(mice[i].fds[MOTION_INTERFACE], report, sizeof(report));
+        mice[i].motion++;
+    }
+}
+
+static int create_timer(uint64_t data, long interval_ns) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+
+    if (interval_ns) {
+        struct itimerspec spec = {
+            .it_value = { interval_ns / 1000000000L, interval_ns % 1000000000L },
+            .it_interval = { interval_ns / 1000000000L, interval_ns % 1000000000L },
+        };
+        timerfd_settime(fd, 0, &spec, NULL);
+    }
+
+    watch_fd(fd, data);
+    return fd;
+}
+
+// What the kernel did, system wide, see sample_kernel
+struct kernel_sample {
+    double busy_s;                 // System, IRQ and softirq time of all CPUs
+    unsigned long long ctxt;       // Context switches
+    long slab_kb;                  // Slab memory
+    unsigned long driver_requests; // Summed over the vxe_battery debugfs files
+    bool debugfs;                  // Whether any vxe_battery file could be read
+    double sim_system_s;           // The simulator's own system time, spent in the uhid writes
+};
+
+// Sums a counter over the vxe_battery debugfs files of every HID device
+static bool sum_debugfs(const char *field, unsigned long *sum) {
+    glob_t files;
+    bool found = false;
+
+    *sum = 0;
+    if (glob("/sys/kernel/debug/hid/*/vxe_battery", 0, NULL, &files))
+        return false;
+    for (size_t i = 0; i < files.gl_pathc; i++) {
+        FILE *f = fopen(files.gl_pathv[i], "r");
+        char line[128];
+        unsigned long value;
+
+        if (!f)
+            continue;
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, field, strlen(field)) == 0 && line[strlen(field)] == ':' &&
+                sscanf(line + strlen(field) + 1, "%lu", &value) == 1) {
+                *sum += value;
+                found = true;
+            }
+        }
+        fclose(f);
+    }
+    globfree(&files);
+    return found;
+}
+
+static void sample_kernel(struct kernel_sample *k) {
+    char line[256];
+    FILE *f;
+
+    memset(k, 0, sizeof(*k));
+    if ((f = fopen("/proc/stat", "r"))) {
+        unsigned long long user, nice, system, idle, iowait, irq, softirq;
+        double tick = sysconf(_SC_CLK_TCK);
+
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &iowait,
+                       &irq, &softirq) == 7)
+                k->busy_s = (system + irq + softirq) / tick;
+            sscanf(line, "ctxt %llu", &k->ctxt);
+        }
+        fclose(f);
+    }
+    if ((f = fopen("/proc/meminfo", "r"))) {
+        while (fgets(line, sizeof(line), f))
+            sscanf(line, "Slab: %ld kB", &k->slab_kb);
+        fclose(f);
+    }
+    k->debugfs = sum_debugfs("requests", &k->driver_requests);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    k->sim_system_s = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void print_summary(const struct timespec *start, const struct kernel_sample *before_create,
+                          const struct kernel_sample *before_run) {
+    struct kernel_sample after;
+    struct timespec now;
+    struct rusage usage;
+    unsigned long requests = 0, responses = 0, dropped = 0, motion = 0, plugs = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    getrusage(RUSAGE_SELF, &usage);
+    sample_kernel(&after);
+
+    for (int i = 0; i < opts.count; i++) {
+        struct sim_mouse *m = &mice[i];
+
+        if (opts.verbose)
+            printf("mouse %d: level %.1f%% requests %lu responses %lu dropped %lu motion %lu plugs %lu\n",
+                   i, m->level, m->requests, m->responses, m->dropped, m->motion, m->plugs);
+        requests += m->requests;
+        responses += m->responses;
+        dropped += m->dropped;
+        motion += m->motion;
+        plugs += m->plugs;
+    }
+
+    double seconds = elapsed_seconds(start, &now);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                 usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    printf("mice:      %d\n", opts.count);
+    printf("runtime:   %.1f s\n", seconds);
+    printf("requests:  %lu (%.2f/s)\n", requests, requests / seconds);
+    printf("responses: %lu\n", responses);
+    printf("dropped:   %lu\n", dropped);
+    printf("motion:    %lu reports (%.0f/s)\n", motion, motion / seconds);
+    printf("plugs:     %lu\n", plugs);
+    printf("sim cpu:   %.2f s (%.1f%%)\n", cpu, 100.0 * cpu / seconds);
+
+    // The simulator's own system time went into the uhid writes, not the driver
+    double kernel = after.busy_s - before_run->busy_s - (after.sim_system_s - before_run->sim_system_s);
+    double per_mouse = opts.count ? 1.0 / opts.count : 0;
+    printf("kernel cpu: %.2f s (%.1f%%, %.3f ms/s per mouse)\n", kernel, 100.0 * kernel / seconds,
+           1000.0 * kernel / seconds * per_mouse);
+    printf("kernel ctxt: %.0f/s (%.1f/s per mouse)\n", (after.ctxt - before_run->ctxt) / seconds,
+           (after.ctxt - before_run->ctxt) / seconds * per_mouse);
+    printf("kernel slab: %+ld kB (%.1f kB per mouse)\n", after.slab_kb - before_create->slab_kb,
+           (after.slab_kb - before_create->slab_kb) * per_mouse);
+    if (after.debugfs)
+        printf("driver requests: %lu (%.2f/s, counters of plugged mice only)\n", after.driver_requests,
+               after.driver_requests / seconds);
+    else
+        printf("driver requests: unknown, vxe_battery debugfs files not readable\n");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -n COUNT    number of virtual mice (default 1)\n"
+        "  -w          show up as the wired mouse (0xf58c) instead of the dongle (0xf58a)\n"
+        "  -D DIR      directory with the int0, int1 and int2 descriptors (default ../investigation)\n"
+        "  -d MS       battery response delay (default 5)\n"
+        "  -j MS       random extra response delay (default 0)\n"
+        "  -l PERCENT  share of battery responses that are dropped (default 0)\n"
+        "  -c CURVE    battery curve: discharge, charge or flat (default discharge)\n"
+        "  -s PERCENT  starting battery level (default 80)\n"
+        "  -S SECONDS  seconds per percent of charge or discharge (default 60)\n"
+        "  -r HZ       motion reports per second per mouse, 0 to disable (default 1000)\n"
+        "  -C MS       plug or unplug a random mouse every MS milliseconds (default off)\n"
+        "  -t SECONDS  run time (default until interrupted)\n"
+        "  -u          give every mouse its own serial number\n"
+        "  -v          print per mouse statistics on exit\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:wD:d:j:l:c:s:S:r:C:t:uvh")) != -1) {
+        switch (opt) {
+        case 'n': opts.count = atoi(optarg); break;
+        case 'w': opts.product = PRODUCT_WIRED; break;
+        case 'D': opts.desc_dir = optarg; break;
+        case 'd': opts.delay_ms = atoi(optarg); break;
+        case 'j': opts.jitter_ms = atoi(optarg); break;
+        case 'l': opts.drop_rate = atof(optarg) / 100.0; break;
+        case 'c':
+            if (!strcmp(optarg, "discharge")) {
+                opts.curve = CURVE_DISCHARGE;
+            } else if (!strcmp(optarg, "charge")) {
+                opts.curve = CURVE_CHARGE;
+            } else if (!strcmp(optarg, "flat")) {
+                opts.curve = CURVE_FLAT;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's': opts.start_level = atof(optarg); break;
+        case 'S': opts.seconds_per_pct = atof(optarg); break;
+        case 'r': opts.motion_hz = atoi(optarg); break;
+        case 'C': opts.churn_ms = atoi(optarg); break;
+        case 't': opts.duration_s = atoi(optarg); break;
+        case 'u': opts.unique_serials = true; break;
+        case 'v': opts.verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (opts.count < 1 || opts.delay_ms < 0 || opts.jitter_ms < 0 || opts.motion_hz < 0 ||
+        opts.seconds_per_pct <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < INTERFACES; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/int%d", opts.desc_dir, i);
+        if (load_descriptor(path, &descriptors[i]) < 0) {
+            fprintf(stderr, "Failed to load descriptor %s\n", path);
+            return 1;
+        }
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    watch_fd(signal_fd, pack_source(SOURCE_SIGNAL, 0, 0));
+
+    srand(time(NULL));
+
+    struct kernel_sample before_create, before_run;
+    sample_kernel(&before_create);
+
+    mice = calloc(opts.count, sizeof(*mice));
+    if (!mice) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < opts.count; i++) {
+        struct sim_mouse *m = &mice[i];
+
+        m->index = i;
+        m->level = opts.start_level;
+        m->charging = opts.curve == CURVE_CHARGE;
+        clock_gettime(CLOCK_MONOTONIC, &m->last_update);
+        m->response_timer = create_timer(pack_source(SOURCE_RESPONSE, i, 0), 0);
+        mouse_plug(m);
+    }
+    printf("Created %d virtual mice (%d uhid devices)\n", opts.count, opts.count * INTERFACES);
+
+    if (opts.motion_hz)
+        motion_timer = create_timer(pack_source(SOURCE_MOTION, 0, 0), 1000000000L / opts.motion_hz);
+    if (opts.churn_ms)
+        churn_timer = create_timer(pack_source(SOURCE_CHURN, 0, 0), opts.churn_ms * 1000000L);
+    if (opts.duration_s)
+        create_timer(pack_source(SOURCE_DURATION, 0, 0), opts.duration_s * 1000000000L);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sample_kernel(&before_run);
+
+    bool running = true;
+    struct epoll_event events[64];
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            enum source_kind kind;
+            int index, intf;
+            uint64_t expirations;
+            unpack_source(events[i].data.u64, &kind, &index, &intf);
+
+            switch (kind) {
+            case SOURCE_UHID:
+                // Events of an unplugged mouse can still be queued in this batch
+                if (mice[index].plugged)
+                    handle_uhid(&mice[index], intf);
+                break;
+            case SOURCE_RESPONSE:
+                if (read(mice[index].response_timer, &expirations, sizeof(expirations)) > 0 &&
+                    mice[index].plugged)
+                    send_battery_response(&mice[index]);
+                break;
+            case SOURCE_MOTION:
+                // Missed ticks are not made up for, like a real mouse
+                if (read(motion_timer, &expirations, sizeof(expirations)) > 0)
+                    send_motion();
+                break;
+            case SOURCE_CHURN: {
+                if (read(churn_timer, &expirations, sizeof(expirations)) <= 0)
+                    break;
+                struct sim_mouse *m = &mice[rand() % opts.count];
+                if (m->plugged)
+                    mouse_unplug(m);
+                else
+                    mouse_plug(m);
+                break;
+            }
+            case SOURCE_DURATION:
+                running = false;
+                break;
+            case SOURCE_SIGNAL:
+                running = false;
+                break;
+            }
+        }
+    }
+
+    print_summary(&start, &before_create, &before_run);
+
+    for (int i = 0; i < opts.count; i++) {
+        if (mice[i].plugged)
+            mouse_unplug(&mice[i]);
+    }
+    free(mice);
+    return 0;
+}
@@ -0,0 +1,545 @@
+// Replays usbmon captures of the VXE dongle through the vendor protocol parser.
+//
+// Reads a capture as a stream, so captures of any length take the same small
+// amount of memory, picks out the vendor reports (ID 0x08) sent to and
+// received from the mouse and decodes them with module/vxe-protocol.h, the
+// same code the driver uses. Prints a summary of the decode results, the
+// request to response latency and how fast the capture was processed.
+//
+// Supported captures, detected from their first bytes:
+//   usbmon text     cat /sys/kernel/debug/usb/usbmon/1u > capture.txt
+//   usbmon binary   cat /dev/usbmon1 > capture.bin (48 byte headers, -m for 64 byte ones)
+//   pcap, pcapng    Wireshark or tcpdump -i usbmon1 -w capture.pcapng
+//
+// Build: gcc -O2 -Wall usbmon-replay.c -o usbmon-replay
+//
+// Usage: ./usbmon-replay [-b bus] [-d device] [-m] [-v] <capture|->
+//
+// -b and -d only look at one device, -v prints every decoded report as CSV.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../module/vxe-protocol.h"
+
+// usbmon transfer types, as in the binary header
+#define XFER_ISO     0
+#define XFER_INTR    1
+#define XFER_CONTROL 2
+#define XFER_BULK    3
+
+// Size of the binary event header, the mmap API and LINKTYPE_USB_LINUX_MMAPPED add 16 bytes
+#define USBMON_HDR_SIZE      48
+#define USBMON_HDR_SIZE_MMAP 64
+
+#define LINKTYPE_USB_LINUX        189
+#define LINKTYPE_USB_LINUX_MMAPPED 220
+
+#define PCAP_MAGIC_US  0xa1b2c3d4
+#define PCAP_MAGIC_NS  0xa1b23c4d
+#define PCAPNG_SHB     0x0a0d0d0a
+#define PCAPNG_IDB     0x00000001
+#define PCAPNG_SPB     0x00000003
+#define PCAPNG_EPB     0x00000006
+#define PCAPNG_BOM     0x1a2b3c4d
+
+// Largest record or block that is looked at, anything bigger is skipped
+#define MAX_RECORD_SIZE (256 * 1024)
+#define MAX_INTERFACES  16
+#define MAX_DEVICES     32
+
+// One usbmon event, in whatever format it was captured
+struct usb_event {
+    double time_s;
+    char type;              // 'S'ubmission, 'C'allback or 'E'rror
+    uint8_t xfer;           // XFER_*
+    bool in;
+    uint16_t bus;
+    uint8_t device;
+    const uint8_t *data;    // Captured data, may be shorter than the transfer
+    size_t len;
+};
+
+// Requests waiting for their response, per device
+struct device_state {
+    uint16_t bus;
+    uint8_t device;
+    double sent[256];       // When the last request of each command was sent, 0 if answered
+};
+
+struct stats {
+    unsigned long events;
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long battery;          // Battery responses that decoded
+    unsigned long out_of_range;     // Battery responses with a nonsense level
+    unsigned long bad_size;         // Vendor reports of the wrong size
+    unsigned long bad_checksum;
+    unsigned long unmatched;        // Responses without a request in the capture
+    unsigned long matched;
+    double latency_sum_us, latency_max_us;
+    unsigned long commands[256];    // Requests per command ID
+    uint64_t bytes;
+};
+
+struct options {
+    int bus;                // Only this bus, -1 for all
+    int device;             // Only this device, -1 for all
+    bool mmapped;           // Binary usbmon capture with 64 byte headers
+    bool verbose;
+};
+
+static struct options opts = { .bus = -1, .device = -1 };
+static struct stats stats;
+static struct device_state devices[MAX_DEVICES];
+static int device_count;
+
+// Buffered reader with a few bytes of pushback for the format detection
+struct reader {
+    FILE *f;
+    uint8_t peek[8];
+    size_t peek_len, peek_pos;
+};
+
+static size_t reader_read(struct reader *r, void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len && r->peek_pos < r->peek_len)
+        ((uint8_t *)buf)[done++] = r->peek[r->peek_pos++];
+    if (done < len) {
+        size_t n = fread((uint8_t *)buf + done, 1, len - done, r->f);
+        stats.bytes += n;
+        done += n;
+    }
+    return done;
+}
+
+static bool reader_skip(struct reader *r, size_t len) {
+    uint8_t buf[4096];
+    while (len > 0) {
+        size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+        if (reader_read(r, buf, chunk) != chunk)
+            return false;
+        len -= chunk;
+    }
+    return true;
+}
+
+static uint16_t get16(const uint8_t *p, bool swap) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t get32(const uint8_t *p, bool swap) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static uint64_t get64(const uint8_t *p, bool swap) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap64(v) : v;
+}
+
+static struct device_state *find_device(uint16_t bus, uint8_t device) {
+    for (int i = 0; i < device_count; i++) {
+        if (devices[i].bus == bus && devices[i].device == device)
+            return &devices[i];
+    }
+    if (device_count == MAX_DEVICES)
+        return NULL;
+
+    struct device_state *state = &devices[device_count++];
+    state->bus = bus;
+    state->device = device;
+    return state;
+}
+
+// Decodes a vendor report sent to or received from the mouse
+static void handle_event(const struct usb_event *ev) {
+    stats.events++;
+    if ((opts.bus >= 0 && ev->bus != opts.bus) || (opts.device >= 0 && ev->device != opts.device))
+        return;
+
+    // Requests are captured when submitted, responses when they complete
+    bool request = ev->type == 'S' && !ev->in;
+    bool response = ev->type == 'C' && ev->in;
+    if (ev->xfer == XFER_ISO || (!request && !response))
+        return;
+
+    int command = vxe_report_command(ev->data, ev->len);
+    if (command == -EPROTO)
+        return;
+    if (command == -EMSGSIZE) {
+        stats.bad_size++;
+        return;
+    }
+
+    // The driver does not check it either, so a bad checksum is only counted
+    bool checksum_ok = vxe_checksum(ev->data) == ev->data[VXE_OFF_CHECKSUM];
+    stats.bad_checksum += !checksum_ok;
+
+    struct device_state *state = find_device(ev->bus, ev->device);
+    double latency_us = -1;
+
+    if (request) {
+        stats.requests++;
+        stats.commands[command]++;
+        if (state)
+            state->sent[command] = ev->time_s;
+    } else {
+        stats.responses++;
+        if (state && state->sent[command] > 0) {
+            latency_us = (ev->time_s - state->sent[command]) * 1e6;
+            // usbmon text timestamps are 32 bit microseconds and wrap every 71 minutes
+            if (latency_us < 0)
+                latency_us += 4294967296.0;
+            state->sent[command] = 0;
+            stats.matched++;
+            stats.latency_sum_us += latency_us;
+            if (latency_us > stats.latency_max_us)
+                stats.latency_max_us = latency_us;
+        } else {
+            stats.unmatched++;
+        }
+    }
+
+    struct vxe_battery_info info;
+    int ret = response && command == VXE_CMD_BATTERY ? vxe_parse_battery(ev->data, ev->len, &info) : -EPROTO;
+    if (ret == 0)
+        stats.battery++;
+    else if (ret == -ERANGE)
+        stats.out_of_range++;
+
+    if (!opts.verbose)
+        return;
+    printf("%.6f,%u,%u,%s,0x%02x,%d,", ev->time_s, ev->bus, ev->device, request ? "out" : "in", command,
+           checksum_ok);
+    if (ret == 0)
+        printf("%u,%u,%u,", info.level, info.charge, info.voltage_mv);
+    else
+        printf(",,,");
+    if (latency_us >= 0)
+        printf("%.0f\n", latency_us);
+    else
+        printf("\n");
+}
+
+// Parses a binary usbmon event header followed by its captured data
+static bool parse_binary_event(const uint8_t *rec, size_t len, size_t hdr_size, bool swap, struct usb_event *ev) {
+    if (len < hdr_size)
+        return false;
+
+    uint32_t len_cap = get32(rec + 36, swap);
+    ev->type = rec[8];
+    ev->xfer = rec[9];
+    ev->in = rec[10] & 0x80;
+    ev->device = rec[11];
+    ev->bus = get16(rec + 12, swap);
+    ev->time_s = (double)(int64_t)get64(rec + 16, swap) + (int32_t)get32(rec + 24, swap) / 1e6;
+    // flag_data is 0 when data was captured
+    ev->data = rec + hdr_size;
+    ev->len = rec[15] == 0 ? len - hdr_size : 0;
+    if (ev->len > len_cap)
+        ev->len = len_cap;
+    return true;
+}
+
+// Raw records as read from /dev/usbmonN: a header and len_cap bytes of data
+static int replay_usbmon_binary(struct reader *r) {
+    size_t hdr_size = opts.mmapped ? USBMON_HDR_SIZE_MMAP : USBMON_HDR_SIZE;
+    static uint8_t rec[MAX_RECORD_SIZE];
+
+    while (reader_read(r, rec, hdr_size) == hdr_size) {
+        uint32_t len_cap = get32(rec + 36, false);
+        if (len_cap > MAX_RECORD_SIZE - hdr_size) {
+            if (!reader_skip(r, len_cap))
+                break;
+            continue;
+        }
+        if (reader_read(r, rec + hdr_size, len_cap) != len_cap)
+            break;
+
+        struct usb_event ev;
+        if (parse_binary_event(rec, hdr_size + len_cap, hdr_size, false, &ev))
+            handle_event(&ev);
+    }
+    return 0;
+}
+
+// Handles one captured packet of a pcap or pcapng file
+static void handle_packet(const uint8_t *pkt, size_t len, int linktype, bool swap) {
+    struct usb_event ev;
+    size_t hdr_size = linktype == LINKTYPE_USB_LINUX_MMAPPED ? USBMON_HDR_SIZE_MMAP : USBMON_HDR_SIZE;
+
+    if (linktype != LINKTYPE_USB_LINUX && linktype != LINKTYPE_USB_LINUX_MMAPPED)
+        return;
+    if (parse_binary_event(pkt, len, hdr_size, swap, &ev))
+        handle_event(&ev);
+}
+
+// The usbmon header is in the byte order of the capturing machine, which is the one of the file
+static int replay_pcap(struct reader *r, uint32_t magic) {
+    uint8_t hdr[24];
+    static uint8_t rec[MAX_RECORD_SIZE];
+    bool swap = magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS;
+
+    if (reader_read(r, hdr, sizeof(hdr)) != sizeof(hdr))
+        return -1;
+    int linktype = get32(hdr + 20, swap) & 0xffff;
+    if (linktype != LINKTYPE_USB_LINUX && linktype != LINKTYPE_USB_LINUX_MMAPPED) {
+        fprintf(stderr, "Not a usbmon capture (link type %d)\n", linktype);
+        return -1;
+    }
+
+    uint8_t rec_hdr[16];
+    while (reader_read(r, rec_hdr, sizeof(rec_hdr)) == sizeof(rec_hdr)) {
+        uint32_t incl_len = get32(rec_hdr + 8, swap);
+        if (incl_len > MAX_RECORD_SIZE) {
+            if (!reader_skip(r, incl_len))
+                break;
+            continue;
+        }
+        if (reader_read(r, rec, incl_len) != incl_len)
+            break;
+        handle_packet(rec, incl_len, linktype, swap);
+    }
+    return 0;
+}
+
+static int replay_pcapng(struct reader *r) {
+    static uint8_t block[MAX_RECORD_SIZE];
+    int linktypes[MAX_INTERFACES];
+    int interfaces = 0;
+    bool swap = false;
+    uint8_t hdr[8];
+
+    while (reader_read(r, hdr, sizeof(hdr)) == sizeof(hdr)) {
+        uint32_t type = get32(hdr, swap);
+        uint32_t total = get32(hdr + 4, swap);
+
+        // The section header decides the byte order of everything after it
+        if (type == PCAPNG_SHB) {
+            uint8_t bom[4];
+            if (reader_read(r, bom, sizeof(bom)) != sizeof(bom))
+                break;
+            swap = get32(bom, false) != PCAPNG_BOM;
+            total = get32(hdr + 4, swap);
+            interfaces = 0;
+            if (total < 16 || !reader_skip(r, total - 12))
+                break;
+            continue;
+        }
+
+        if (total < 12 || total % 4) {
+            fprintf(stderr, "Malformed pcapng block\n");
+            return -1;
+        }
+        size_t body = total - 12;
+        if (body > sizeof(block)) {
+            if (!reader_skip(r, body + 4))
+                break;
+            continue;
+        }
+        // The body and the trailing copy of the length
+        if (reader_read(r, block, body + 4) != body + 4)
+            break;
+
+        if (type == PCAPNG_IDB && body >= 8) {
+            if (interfaces < MAX_INTERFACES)
+                linktypes[interfaces++] = get16(block, swap);
+        } else if (type == PCAPNG_EPB && body >= 20) {
+            uint32_t id = get32(block, swap), caplen = get32(block + 12, swap);
+            if (id < (uint32_t)interfaces && caplen <= body - 20)
+                handle_packet(block + 20, caplen, linktypes[id], swap);
+        } else if (type == PCAPNG_SPB && body >= 4 && interfaces > 0) {
+            uint32_t origlen = get32(block, swap);
+            handle_packet(block + 4, origlen < body - 4 ? origlen : body - 4, linktypes[0], swap);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Parses one line of the usbmon text format, e.g.
+ *   ffff8e1c 3575914555 S Co:1:003:0 s 21 09 0208 0001 0011 17 = 08040000 00000000 ...
+ *   ffff8e1c 3575918110 C Ii:1:003:2 0:1 17 = 08040000 00024100 0f830000 ...
+ * Returns false for lines that are not events.
+ */
+static bool parse_text_event(char *line, struct usb_event *ev, uint8_t *data, size_t size) {
+    char *save, *tok;
+    char *fields[4];
+
+    for (int i = 0; i < 4; i++) {
+        fields[i] = strtok_r(i ? NULL : line, " \n", &save);
+        if (!fields[i])
+            return false;
+    }
+
+    unsigned int bus, device, ep;
+    char xfer, dir;
+    if (sscanf(fields[3], "%c%c:%u:%u:%u", &xfer, &dir, &bus, &device, &ep) != 5)
+        return false;
+
+    ev->time_s = strtoul(fields[1], NULL, 10) / 1e6;
+    ev->type = fields[2][0];
+    ev->in = dir == 'i';
+    ev->bus = bus;
+    ev->device = device;
+    switch (xfer) {
+    case 'C': ev->xfer = XFER_CONTROL; break;
+    case 'I': ev->xfer = XFER_INTR; break;
+    case 'B': ev->xfer = XFER_BULK; break;
+    default:  ev->xfer = XFER_ISO; break;
+    }
+
+    // Setup packet or status, then the length and the data tag
+    tok = strtok_r(NULL, " \n", &save);
+    if (tok && strcmp(tok, "s") == 0) {
+        for (int i = 0; i < 5 && tok; i++)
+            tok = strtok_r(NULL, " \n", &save);
+    }
+    tok = tok ? strtok_r(NULL, " \n", &save) : NULL; // Length
+    tok = tok ? strtok_r(NULL, " \n", &save) : NULL; // Data tag
+
+    ev->data = data;
+    ev->len = 0;
+    if (!tok || strcmp(tok, "=") != 0)
+        return true;
+
+    while ((tok = strtok_r(NULL, " \n", &save))) {
+        for (char *p = tok; p[0] && p[1] && ev->len < size; p += 2) {
+            char byte[3] = { p[0], p[1], 0 };
+            data[ev->len++] = strtoul(byte, NULL, 16);
+        }
+    }
+    return true;
+}
+
+static int replay_usbmon_text(struct reader *r) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    uint8_t data[64];
+
+    // The detection already consumed the start of the first line
+    char *first = strndup((char *)r->peek, r->peek_len);
+    r->peek_pos = r->peek_len;
+
+    while ((len = getline(&line, &cap, r->f)) >= 0) {
+        stats.bytes += len;
+        if (first) {
+            char *joined;
+            if (asprintf(&joined, "%s%s", first, line) < 0)
+                break;
+            free(line);
+            free(first);
+            line = joined;
+            cap = strlen(joined) + 1;
+            first = NULL;
+        }
+
+        struct usb_event ev;
+        if (parse_text_event(line, &ev, data, sizeof(data)))
+            handle_event(&ev);
+    }
+    free(first);
+    free(line);
+    return 0;
+}
+
+static void print_summary(double wall_s, double cpu_s) {
+    fprintf(stderr, "events:         %lu\n", stats.events);
+    fprintf(stderr, "requests:       %lu\n", stats.requests);
+    for (int i = 0; i < 256; i++) {
+        if (stats.commands[i])
+            fprintf(stderr, "  command 0x%02x: %lu\n", i, stats.commands[i]);
+    }
+    fprintf(stderr, "responses:      %lu\n", stats.responses);
+    fprintf(stderr, "battery:        %lu\n", stats.battery);
+    fprintf(stderr, "out_of_range:   %lu\n", stats.out_of_range);
+    fprintf(stderr, "bad_size:       %lu\n", stats.bad_size);
+    fprintf(stderr, "bad_checksum:   %lu\n", stats.bad_checksum);
+    fprintf(stderr, "unmatched:      %lu\n", stats.unmatched);
+    if (stats.matched)
+        fprintf(stderr, "latency_us:     avg %.0f, max %.0f\n", stats.latency_sum_us / stats.matched,
+                stats.latency_max_us);
+    fprintf(stderr, "throughput:     %.1f MB/s, %.0f events/s (%.3f s, %.3f s CPU)\n",
+            wall_s > 0 ? stats.bytes / wall_s / 1e6 : 0, wall_s > 0 ? stats.events / wall_s : 0, wall_s, cpu_s);
+}
+
+static double clock_s(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b bus] [-d device] [-m] [-v] <capture|->\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "b:d:mvh")) != -1) {
+        switch (opt) {
+        case 'b': opts.bus = atoi(optarg); break;
+        case 'd': opts.device = atoi(optarg); break;
+        case 'm': opts.mmapped = true; break;
+        case 'v': opts.verbose = true; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct reader r = { .f = stdin };
+    if (strcmp(argv[optind], "-") != 0 && !(r.f = fopen(argv[optind], "rb"))) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    double wall = clock_s(CLOCK_MONOTONIC), cpu = clock_s(CLOCK_PROCESS_CPUTIME_ID);
+
+    // The first four bytes tell the formats apart, text captures start with the URB tag in hex
+    r.peek_len = fread(r.peek, 1, 4, r.f);
+    stats.bytes = r.peek_len;
+    uint32_t magic = r.peek_len == 4 ? get32(r.peek, false) : 0;
+    int ret;
+
+    if (opts.verbose)
+        printf("time_s,bus,device,direction,command,checksum_ok,level,charge,voltage_mv,latency_us\n");
+
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS ||
+        magic == __builtin_bswap32(PCAP_MAGIC_US) || magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+        ret = replay_pcap(&r, magic);
+    } else if (magic == PCAPNG_SHB) {
+        ret = replay_pcapng(&r);
+    } else if (r.peek_len == 4 && strspn((char *)r.peek, "0123456789abcdef") == 4) {
+        ret = replay_usbmon_text(&r);
+    } else {
+        ret = replay_usbmon_binary(&r);
+    }
+
+    if (ferror(r.f)) {
+        perror(argv[optind]);
+        ret = -1;
+    }
+    if (r.f != stdin)
+        fclose(r.f);
+
+    print_summary(clock_s(CLOCK_MONOTONIC) - wall, clock_s(CLOCK_PROCESS_CPUTIME_ID) - cpu);
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+// Reads the battery history kept by the hid-vxe-r1 driver.
+//
+// Build: gcc -O2 -Wall vxe-history.c -o vxe-history
+//
+// Usage: ./vxe-history /sys/class/power_supply/vxe_3554_f58a_bat_1/history [interval_s]
+//
+// Prints every sample in the ring as CSV. With an interval it keeps running
+// and prints new samples as they show up, reading the file once per interval.
+// Samples that were overwritten between two reads are reported as lost.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../module/vxe-history.h"
+
+struct history_file {
+    struct vxe_history_header header;
+    struct vxe_history_record records[VXE_HISTORY_SIZE];
+};
+
+// Reads the whole file in one go, the driver only guarantees a consistent snapshot for that
+static int read_history(int fd, struct history_file *history) {
+    ssize_t res = pread(fd, history, sizeof(*history), 0);
+    if (res < 0) {
+        perror("pread");
+        return -1;
+    }
+    if ((size_t)res < sizeof(history->header) || history->header.magic != VXE_HISTORY_MAGIC ||
+        history->header.version != VXE_HISTORY_VERSION ||
+        history->header.record_size != sizeof(struct vxe_history_record) ||
+        history->header.capacity != VXE_HISTORY_SIZE || (size_t)res != sizeof(*history)) {
+        fprintf(stderr, "Unsupported history file\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Prints the samples from next up to the newest one, returns the sequence to continue from
+static uint32_t print_samples(const struct history_file *history, uint32_t next) {
+    uint32_t end = history->header.sequence;
+    uint32_t oldest = end > VXE_HISTORY_SIZE ? end - VXE_HISTORY_SIZE : 0;
+
+    if (next < oldest) {
+        fprintf(stderr, "%u samples lost, read more often\n", oldest - next);
+        next = oldest;
+    }
+
+    for (; next < end; next++) {
+        const struct vxe_history_record *record = &history->records[next % VXE_HISTORY_SIZE];
+        printf("%u,%lld,%d,%u,%u\n", record->sequence, (long long)record->timestamp_ns,
+               record->capacity, record->status, record->voltage_mv);
+    }
+    fflush(stdout);
+    return next;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <history file> [interval_s]\n", argv[0]);
+        return 1;
+    }
+    int interval_s = argc > 2 ? atoi(argv[2]) : 0;
+
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct history_file history;
+    uint32_t next = 0;
+    printf("sequence,timestamp_ns,capacity,status,voltage_mv\n");
+    do {
+        if (read_history(fd, &history) < 0) {
+            close(fd);
+            return 1;
+        }
+        next = print_samples(&history, next);
+    } while (interval_s > 0 && sleep(interval_s) == 0);
+
+    close(fd);
+    return 0;
+}